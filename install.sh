@@ -28,9 +28,15 @@ fi
 rm -f build/RRT_omp
 rm -f build/RRT_pthread
 rm -f build/RRT_serial
+rm -f build/RRT_ws
+rm -f build/RRT_3d
+rm -f build/RRT_mpi
 rm -f ./RRT_omp
 rm -f ./RRT_pthread
 rm -f ./RRT_serial
+rm -f ./RRT_ws
+rm -f ./RRT_3d
+rm -f ./RRT_mpi
 
 cmake -B build
 cmake --build build
@@ -38,3 +44,8 @@ cmake --build build
 ln -s build/RRT_omp RRT_omp
 ln -s build/RRT_pthread RRT_pthread
 ln -s build/RRT_serial RRT_serial
+ln -s build/RRT_ws RRT_ws
+ln -s build/RRT_3d RRT_3d
+if [ -f build/RRT_mpi ]; then
+    ln -s build/RRT_mpi RRT_mpi
+fi
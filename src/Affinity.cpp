@@ -0,0 +1,252 @@
+#include "Affinity.h"
+
+#include <dirent.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <tuple>
+
+#include "Util.h"
+
+namespace {
+    struct CpuInfo {
+            int cpu;
+            int node;
+            int package;
+            int core;
+            int sibling; // 0 for the first hardware thread of a core
+    };
+
+    ThreadConfig config_;
+    vector<CpuInfo> placement; // placement[t] for thread t, empty when not pinned
+    vector<int> cpu_nodes;     // NUMA node of every cpu id
+    int node_count = 1;
+
+    const GridMap *replicated_from = nullptr;
+    vector<GridMap> replicas; // replicas[node]
+    thread_local int tls_node = -1;
+
+    int read_int(const string &path, int fallback) {
+        ifstream in(path);
+        int value;
+        return (in >> value) ? value : fallback;
+    }
+
+    // "0-3,8,10-11" -> {0, 1, 2, 3, 8, 10, 11}
+    bool parse_cpu_list(const string &text, vector<int> &cpus) {
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t comma = text.find(',', pos);
+            string item = text.substr(pos, comma == string::npos ? string::npos : comma - pos);
+            pos = comma == string::npos ? text.size() : comma + 1;
+            if (item.empty() || item == "\n") continue;
+            char *rest;
+            long low = strtol(item.c_str(), &rest, 10);
+            long high = low;
+            if (rest == item.c_str() || low < 0) return false;
+            if (*rest == '-') high = strtol(rest + 1, &rest, 10);
+            if ((*rest && *rest != '\n') || high < low) return false;
+            for (long cpu = low; cpu <= high; cpu++) cpus.push_back(cpu);
+        }
+        return !cpus.empty();
+    }
+
+    // CPUs this process may run on, with their place in the machine
+    vector<CpuInfo> read_topology() {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        sched_getaffinity(0, sizeof(allowed), &allowed);
+
+        cpu_nodes.assign(CPU_SETSIZE, 0);
+        node_count = 1;
+        if (DIR *dir = opendir("/sys/devices/system/node")) {
+            while (dirent *entry = readdir(dir)) {
+                int node;
+                if (sscanf(entry->d_name, "node%d", &node) != 1) continue;
+                ifstream in(string("/sys/devices/system/node/") + entry->d_name + "/cpulist");
+                string text;
+                getline(in, text);
+                vector<int> cpus;
+                if (!parse_cpu_list(text, cpus)) continue;
+                for (int cpu : cpus) {
+                    if (cpu < CPU_SETSIZE) cpu_nodes[cpu] = node;
+                }
+                node_count = max(node_count, node + 1);
+            }
+            closedir(dir);
+        }
+
+        vector<CpuInfo> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &allowed)) continue;
+            string base = "/sys/devices/system/cpu/cpu" + to_string(cpu) + "/topology/";
+            cpus.push_back({cpu, cpu_nodes[cpu], read_int(base + "physical_package_id", 0),
+                            read_int(base + "core_id", cpu), 0});
+        }
+        // number the hardware threads inside each core
+        for (size_t i = 0; i < cpus.size(); i++) {
+            for (size_t j = 0; j < i; j++) {
+                if (cpus[j].package == cpus[i].package && cpus[j].core == cpus[i].core) {
+                    cpus[i].sibling++;
+                }
+            }
+        }
+        return cpus;
+    }
+} // namespace
+
+bool parse_affinity(const char *arg, ThreadConfig &config) {
+    if (!strcmp(arg, "compact")) {
+        config.affinity = AffinityMode::Compact;
+    } else if (!strcmp(arg, "scatter")) {
+        config.affinity = AffinityMode::Scatter;
+    } else {
+        config.cpu_list.clear();
+        if (!parse_cpu_list(arg, config.cpu_list)) return false;
+        config.affinity = AffinityMode::List;
+    }
+    return true;
+}
+
+void configure_threads(const ThreadConfig &config) {
+    config_ = config;
+    // a replica only helps if the threads stay on its node
+    if (config_.numa && config_.affinity == AffinityMode::None) {
+        config_.affinity = AffinityMode::Compact;
+    }
+    vector<CpuInfo> cpus = read_topology();
+    placement.clear();
+    if (config_.affinity == AffinityMode::None || cpus.empty()) return;
+
+    vector<CpuInfo> order;
+    if (config_.affinity == AffinityMode::List) {
+        for (int cpu : config_.cpu_list) {
+            auto it = find_if(cpus.begin(), cpus.end(),
+                              [cpu](const CpuInfo &info) { return info.cpu == cpu; });
+            if (it != cpus.end()) order.push_back(*it);
+        }
+        if (order.empty()) order = cpus;
+    } else if (config_.affinity == AffinityMode::Compact) {
+        // neighbours first: fill a core, then a package, then a node
+        order = cpus;
+        sort(order.begin(), order.end(), [](const CpuInfo &a, const CpuInfo &b) {
+            return make_tuple(a.node, a.package, a.core, a.sibling, a.cpu) <
+                   make_tuple(b.node, b.package, b.core, b.sibling, b.cpu);
+        });
+    } else {
+        // spread out: one core per node in turn, second hardware threads last
+        vector<vector<CpuInfo>> per_node(node_count);
+        for (const CpuInfo &info : cpus) per_node[info.node].push_back(info);
+        for (auto &list : per_node) {
+            sort(list.begin(), list.end(), [](const CpuInfo &a, const CpuInfo &b) {
+                return make_tuple(a.sibling, a.package, a.core, a.cpu) <
+                       make_tuple(b.sibling, b.package, b.core, b.cpu);
+            });
+        }
+        for (size_t round = 0; order.size() < cpus.size(); round++) {
+            for (auto &list : per_node) {
+                if (round < list.size()) order.push_back(list[round]);
+            }
+        }
+    }
+
+    int count = thread_count(std::thread::hardware_concurrency());
+    for (int t = 0; t < count; t++) placement.push_back(order[t % order.size()]);
+    pin_current_thread(0);
+}
+
+const ThreadConfig &thread_config() { return config_; }
+
+int thread_count(int fallback) {
+    return config_.num_threads > 0 ? config_.num_threads : max(1, fallback);
+}
+
+int cpu_for_thread(int t) {
+    if (placement.empty()) return -1;
+    return placement[t % placement.size()].cpu;
+}
+
+int numa_node_of_cpu(int cpu) {
+    if (cpu < 0 || cpu >= (int)cpu_nodes.size()) return 0;
+    return cpu_nodes[cpu];
+}
+
+int numa_node_count() { return node_count; }
+
+void pin_current_thread(int t) {
+    int cpu = cpu_for_thread(t);
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    tls_node = numa_node_of_cpu(cpu);
+}
+
+void pin_thread_attr(pthread_attr_t *attr, int t) {
+    int cpu = cpu_for_thread(t);
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+void replicate_map(const GridMap &map) {
+    replicas.clear();
+    replicated_from = nullptr;
+    if (!config_.numa || node_count < 2) return;
+
+    replicas.resize(node_count);
+    for (int node = 0; node < node_count; node++) {
+        int cpu = -1;
+        for (int c = 0; c < (int)cpu_nodes.size() && cpu < 0; c++) {
+            if (cpu_nodes[c] == node) cpu = c;
+        }
+        // allocate and fill from a thread on that node so the pages land there
+        thread filler([&map, node, cpu] {
+            if (cpu >= 0) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            }
+            replicas[node] = map;
+        });
+        filler.join();
+    }
+    replicated_from = &map;
+}
+
+const GridMap &local_map(const GridMap &map) {
+    if (replicated_from != &map) return map;
+    if (tls_node < 0) tls_node = numa_node_of_cpu(sched_getcpu());
+    return replicas[tls_node];
+}
+
+void update_replicas(const GridMap &map, int x, int y, int width, int height) {
+    if (replicated_from != &map) return;
+    for (GridMap &replica : replicas) {
+        for (int row = y; row < y + height; row++) {
+            copy(map[row] + x, map[row] + x + width, replica[row] + x);
+        }
+    }
+}
+
+void print_placement(FILE *out) {
+    fprintf(out, "Threads: %d, NUMA nodes: %d, map replicas: %zu\n",
+            thread_count(std::thread::hardware_concurrency()), node_count, replicas.size());
+    if (placement.empty()) {
+        fprintf(out, "  threads not pinned\n");
+        return;
+    }
+    for (size_t t = 0; t < placement.size(); t++) {
+        const CpuInfo &info = placement[t];
+        fprintf(out, "  thread %2zu -> cpu %3d (node %d, package %d, core %d%s)\n", t, info.cpu,
+                info.node, info.package, info.core, info.sibling ? ", sibling" : "");
+    }
+}
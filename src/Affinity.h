@@ -0,0 +1,48 @@
+#ifndef __RRT_AFFINITY__
+#define __RRT_AFFINITY__
+
+#include <pthread.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct GridMap;
+
+enum class AffinityMode { None, Compact, Scatter, List };
+
+struct ThreadConfig {
+        int num_threads = 0; // 0 keeps each backend's default
+        AffinityMode affinity = AffinityMode::None;
+        std::vector<int> cpu_list; // for AffinityMode::List
+        bool numa = false;         // replicate the inflated map on every NUMA node
+};
+
+// "compact", "scatter" or a cpu list like "0,2,4-7"; false if it cannot be parsed
+bool parse_affinity(const char *arg, ThreadConfig &config);
+
+// Read the topology and work out where thread t of every backend goes. Call once,
+// before the first kernel runs; also pins the calling thread as thread 0.
+void configure_threads(const ThreadConfig &config);
+const ThreadConfig &thread_config();
+
+// configured thread count, or fallback when none was given
+int thread_count(int fallback);
+// cpu of thread t, -1 when threads are not pinned
+int cpu_for_thread(int t);
+int numa_node_of_cpu(int cpu);
+int numa_node_count();
+
+void pin_current_thread(int t);
+// same placement for a thread that is about to be created
+void pin_thread_attr(pthread_attr_t *attr, int t);
+
+// Copy the read-only map once per NUMA node, each copy first-touched by a thread on its
+// node. local_map() then hands every thread the copy of the node it runs on.
+void replicate_map(const GridMap &map);
+const GridMap &local_map(const GridMap &map);
+// copy an edited window of map into every replica
+void update_replicas(const GridMap &map, int x, int y, int width, int height);
+
+void print_placement(FILE *out);
+#endif
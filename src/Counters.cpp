@@ -0,0 +1,437 @@
+#include "Counters.h"
+
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+#include "Util.h"
+
+struct ThreadCounters {
+        pid_t tid = 0;
+        string name;
+        bool attached = false; // opened by counters_attach_threads() rather than the thread
+        int leader = -1;
+        int fds[kCounterCount];
+        int slot[kCounterCount]; // position in the group read, -1 when not counted
+        int nr = 0;
+        uint64_t base[kCounterCount] = {}; // when the group was opened
+        uint64_t phase[kPhaseCount][kCounterCount] = {};
+        uint64_t calls[kPhaseCount] = {};
+        // Threads that exited, merged by name: no fds, tid 0, totals holds their
+        // whole-thread counts.
+        bool exited = false;
+        int threads = 0;
+        uint64_t totals[kCounterCount] = {};
+};
+
+namespace {
+    struct EventSpec {
+            const char *name;
+            uint32_t type;
+            uint64_t config;
+    };
+    const EventSpec kEvents[kCounterCount] = {
+        {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {"cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {"context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+        {"task_clock_ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    };
+    const char *kPhaseNames[kPhaseCount] = {
+        "plan",    "replan",  "validate",     "roadmap_build", "roadmap_query",
+        "inflate", "nearest", "intersection", "check_segments"};
+
+    std::atomic<bool> active{false};
+    std::atomic<bool> clock_active{false};
+    std::atomic<uint64_t> phase_ns[kPhaseCount];
+    bool available[kCounterCount] = {}; // events the first thread could open
+    std::mutex registry_mutex;
+    vector<unique_ptr<ThreadCounters>> registry;
+    thread_local ThreadCounters *tls_counters = nullptr;
+    thread_local bool tls_tried = false;
+
+    // Retires the group of the calling thread when the thread exits.
+    struct ThreadExit {
+            ~ThreadExit();
+    };
+    thread_local ThreadExit tls_exit;
+
+    uint64_t clock_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    pid_t current_tid() { return static_cast<pid_t>(syscall(SYS_gettid)); }
+
+    string thread_name(pid_t tid) {
+        ifstream in("/proc/self/task/" + to_string(tid) + "/comm");
+        string name;
+        getline(in, name);
+        return name.empty() ? "?" : name;
+    }
+
+    // One read() for the whole group, scaled up when the kernel had to multiplex it.
+    void read_group(const ThreadCounters &group, uint64_t *out) {
+        uint64_t buf[3 + kCounterCount];
+        memset(out, 0, sizeof(uint64_t) * kCounterCount);
+        ssize_t want = sizeof(uint64_t) * (3 + group.nr);
+        if (read(group.leader, buf, sizeof(buf)) < want || buf[2] == 0) return;
+        double scale = static_cast<double>(buf[1]) / buf[2];
+        for (int e = 0; e < kCounterCount; e++) {
+            if (group.slot[e] >= 0) out[e] = static_cast<uint64_t>(buf[3 + group.slot[e]] * scale);
+        }
+    }
+
+    // Every event in one group on thread tid (0: the caller). Kernel-side counting is
+    // dropped if perf_event_paranoid forbids it, inherit if the kernel cannot combine it
+    // with group reads. Null when not a single event could be opened.
+    unique_ptr<ThreadCounters> open_group(pid_t tid, bool inherit, int &error) {
+        unique_ptr<ThreadCounters> group(new ThreadCounters());
+        group->tid = tid ? tid : current_tid();
+        for (int e = 0; e < kCounterCount; e++) {
+            group->fds[e] = -1;
+            group->slot[e] = -1;
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = kEvents[e].type;
+            attr.config = kEvents[e].config;
+            attr.disabled = group->leader < 0; // members follow the leader
+            attr.inherit = inherit;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                               PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int fd = -1;
+            for (int tries = 0; tries < 3 && fd < 0; tries++) {
+                fd = syscall(SYS_perf_event_open, &attr, tid, -1, group->leader, 0);
+                if (fd >= 0) break;
+                error = errno;
+                if ((errno == EACCES || errno == EPERM) && !attr.exclude_kernel) {
+                    attr.exclude_kernel = 1;
+                    attr.exclude_hv = 1;
+                } else if (errno == EINVAL && attr.inherit) {
+                    attr.inherit = 0;
+                } else {
+                    break;
+                }
+            }
+            if (fd < 0) continue;
+            group->fds[e] = fd;
+            group->slot[e] = group->nr++;
+            if (group->leader < 0) group->leader = fd;
+        }
+        if (group->leader < 0) return nullptr;
+        ioctl(group->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(group->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        group->name = thread_name(group->tid);
+        read_group(*group, group->base);
+        return group;
+    }
+
+    void thread_totals(const ThreadCounters &group, uint64_t *out) {
+        if (group.exited) {
+            memcpy(out, group.totals, sizeof(group.totals));
+            return;
+        }
+        read_group(group, out);
+        for (int e = 0; e < kCounterCount; e++) out[e] -= min(out[e], group.base[e]);
+    }
+
+    // Threads started per query (region threads, pthread kernel workers) would otherwise
+    // keep their fds open until the process runs out of them, and add one row each. Their
+    // final counts go into one exited entry per thread name and the group is closed.
+    ThreadExit::~ThreadExit() {
+        ThreadCounters *group = tls_counters;
+        if (!group) return;
+        tls_counters = nullptr; // tls_tried stays set, so nothing reopens it
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        uint64_t totals[kCounterCount];
+        thread_totals(*group, totals);
+        for (int e = 0; e < kCounterCount; e++) {
+            if (group->fds[e] >= 0) close(group->fds[e]);
+        }
+        ThreadCounters *merged = nullptr;
+        for (auto &entry : registry) {
+            if (entry->exited && entry->name == group->name) merged = entry.get();
+        }
+        if (!merged) {
+            registry.emplace_back(new ThreadCounters());
+            merged = registry.back().get();
+            merged->name = group->name;
+            merged->exited = true;
+        }
+        merged->threads++;
+        for (int e = 0; e < kCounterCount; e++) merged->totals[e] += totals[e];
+        for (int p = 0; p < kPhaseCount; p++) {
+            merged->calls[p] += group->calls[p];
+            for (int e = 0; e < kCounterCount; e++) merged->phase[p][e] += group->phase[p][e];
+        }
+        for (size_t i = 0; i < registry.size(); i++) {
+            if (registry[i].get() == group) {
+                registry.erase(registry.begin() + i);
+                break;
+            }
+        }
+    }
+
+    // name column of a registry row
+    string row_name(const ThreadCounters &group) {
+        if (!group.exited) return group.name;
+        return group.name + " (" + to_string(group.threads) + " exited)";
+    }
+
+    // group of the calling thread, opened on first use; null if that failed
+    ThreadCounters *this_thread() {
+        if (tls_tried) return tls_counters;
+        tls_tried = true;
+        pid_t tid = current_tid();
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        // pool threads were given a group by counters_attach_threads(); other entries may
+        // belong to an exited thread whose tid was reused
+        (void)&tls_exit; // constructs it, so its destructor runs when this thread exits
+        for (auto &group : registry) {
+            if (group->attached && group->tid == tid) return tls_counters = group.get();
+        }
+        int error = 0;
+        unique_ptr<ThreadCounters> group = open_group(0, true, error);
+        if (!group) return nullptr;
+        tls_counters = group.get();
+        registry.push_back(std::move(group));
+        return tls_counters;
+    }
+
+    template <const Backend *inner>
+    struct Counted {
+            static bool intersection(const GridMap &map, const Position &start,
+                                     const Position &end) {
+                CounterScope scope(kPhaseIntersection);
+                return inner->intersection(map, start, end);
+            }
+            static int nearest(const Position *nodes, int count, const Position &target) {
+                CounterScope scope(kPhaseNearest);
+                return inner->nearest(nodes, count, target);
+            }
+            static void inflate_map(const Mat &img, GridMap &out_map, double radius) {
+                CounterScope scope(kPhaseInflate);
+                inner->inflate_map(img, out_map, radius);
+            }
+            static void check_segments(const GridMap &map, const Position *starts,
+                                       const Position *ends, int count, uint8_t *blocked) {
+                CounterScope scope(kPhaseCheckSegments);
+                inner->check_segments(map, starts, ends, count, blocked);
+            }
+            static Backend table() {
+                return {inner->name, intersection, nearest, inflate_map, check_segments};
+            }
+    };
+
+    // values of one row, n/a for events that are not counted
+    void print_values(FILE *out, const uint64_t *values) {
+        for (int e = 0; e < kCounterCount; e++) {
+            if (!available[e]) {
+                fprintf(out, " %14s", "n/a");
+            } else if (e == kTaskClock) {
+                fprintf(out, " %14.3f", values[e] / 1e6);
+            } else {
+                fprintf(out, " %14llu", (unsigned long long)values[e]);
+            }
+        }
+        if (available[kCycles] && available[kInstructions] && values[kCycles]) {
+            fprintf(out, " %6.2f", (double)values[kInstructions] / values[kCycles]);
+        } else {
+            fprintf(out, " %6s", "n/a");
+        }
+        fprintf(out, "\n");
+    }
+} // namespace
+
+CounterScope::CounterScope(CounterPhase _phase) : trace(kPhaseNames[_phase]), phase(_phase) {
+    if (clock_active.load(std::memory_order_relaxed)) {
+        timed = true;
+        clock_start = clock_ns();
+    }
+    if (!active.load(std::memory_order_relaxed)) return;
+    self = this_thread();
+    if (self) read_group(*self, start);
+}
+
+CounterScope::~CounterScope() {
+    if (timed) phase_ns[phase].fetch_add(clock_ns() - clock_start, std::memory_order_relaxed);
+    if (!self) return;
+    uint64_t end[kCounterCount];
+    read_group(*self, end);
+    for (int e = 0; e < kCounterCount; e++) self->phase[phase][e] += end[e] - min(end[e], start[e]);
+    self->calls[phase]++;
+}
+
+bool counters_start() {
+    if (active.load()) return true;
+    ThreadCounters *self = this_thread();
+    if (!self) {
+        // this_thread() only tries once, open again to learn why
+        int error = 0;
+        open_group(0, false, error);
+        fprintf(stderr, "Counters unavailable: %s%s\n", strerror(error),
+                error == EACCES || error == EPERM ? " (see /proc/sys/kernel/perf_event_paranoid)"
+                                                  : "");
+        return false;
+    }
+    string missing;
+    for (int e = 0; e < kCounterCount; e++) {
+        available[e] = self->slot[e] >= 0;
+        if (!available[e]) missing += string(missing.empty() ? "" : ", ") + kEvents[e].name;
+    }
+    if (!missing.empty()) fprintf(stderr, "Counters not available, shown as n/a: %s\n", missing.c_str());
+    active.store(true);
+    return true;
+}
+
+bool counters_enabled() { return active.load(std::memory_order_relaxed); }
+
+void counters_attach_threads() {
+    if (!counters_enabled()) return;
+    DIR *dir = opendir("/proc/self/task");
+    if (!dir) return;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    while (dirent *entry = readdir(dir)) {
+        pid_t tid = atoi(entry->d_name);
+        if (tid <= 0) continue;
+        bool known = false;
+        for (auto &group : registry) known = known || group->tid == tid;
+        if (known) continue;
+        int error = 0;
+        unique_ptr<ThreadCounters> group = open_group(tid, false, error);
+        if (!group) continue;
+        group->attached = true;
+        registry.push_back(std::move(group));
+    }
+    closedir(dir);
+}
+
+void phase_clock_start() { clock_active.store(true); }
+
+bool phase_clock_enabled() { return clock_active.load(std::memory_order_relaxed); }
+
+uint64_t phase_time_ns(CounterPhase phase) { return phase_ns[phase].load(std::memory_order_relaxed); }
+
+const Backend *counted_backend(const Backend *inner) {
+    if (!counters_enabled() && !phase_clock_enabled() && !trace_enabled()) return inner;
+    static const Backend serial = Counted<&serial_backend>::table();
+    static const Backend omp = Counted<&omp_backend>::table();
+    static const Backend pthread = Counted<&pthread_backend>::table();
+    static const Backend ws = Counted<&ws_backend>::table();
+    if (inner == &serial_backend) return &serial;
+    if (inner == &omp_backend) return &omp;
+    if (inner == &pthread_backend) return &pthread;
+    if (inner == &ws_backend) return &ws;
+    return inner;
+}
+
+void print_counters(FILE *out) {
+    if (!counters_enabled()) return;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    fprintf(out, "%-26s %8s", "Counters per phase", "calls");
+    for (int e = 0; e < kCounterCount; e++) {
+        fprintf(out, " %14s", e == kTaskClock ? "task_clock_ms" : kEvents[e].name);
+    }
+    fprintf(out, " %6s\n", "IPC");
+    for (int p = 0; p < kPhaseCount; p++) {
+        uint64_t values[kCounterCount] = {}, calls = 0;
+        for (auto &group : registry) {
+            calls += group->calls[p];
+            for (int e = 0; e < kCounterCount; e++) values[e] += group->phase[p][e];
+        }
+        if (!calls) continue;
+        fprintf(out, "%-26s %8llu", kPhaseNames[p], (unsigned long long)calls);
+        print_values(out, values);
+    }
+    fprintf(out, "%-26s %8s\n", "Counters per thread", "tid");
+    for (auto &group : registry) {
+        uint64_t values[kCounterCount];
+        thread_totals(*group, values);
+        fprintf(out, "%-26s %8d", row_name(*group).c_str(), group->tid);
+        print_values(out, values);
+    }
+}
+
+bool write_counters(const string &file_name) {
+    if (!counters_enabled()) return false;
+    FILE *out = fopen(file_name.c_str(), "w");
+    if (!out) {
+        fprintf(stderr, "cannot open %s for writing\n", file_name.c_str());
+        return false;
+    }
+    const bool json = file_name.size() >= 5 && file_name.compare(file_name.size() - 5, 5, ".json") == 0;
+    auto values_out = [&](const uint64_t *values) {
+        for (int e = 0; e < kCounterCount; e++) {
+            if (json) {
+                fprintf(out, ", \"%s\": ", kEvents[e].name);
+                if (available[e]) {
+                    fprintf(out, "%llu", (unsigned long long)values[e]);
+                } else {
+                    fprintf(out, "null");
+                }
+            } else if (available[e]) {
+                fprintf(out, ",%llu", (unsigned long long)values[e]);
+            } else {
+                fprintf(out, ",");
+            }
+        }
+    };
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    // one row per thread and phase, then one per thread for its whole lifetime
+    if (json) {
+        fprintf(out, "{\n  \"phases\": [");
+    } else {
+        fprintf(out, "scope,name,tid,calls");
+        for (int e = 0; e < kCounterCount; e++) fprintf(out, ",%s", kEvents[e].name);
+        fprintf(out, "\n");
+    }
+    bool first = true;
+    for (auto &group : registry) {
+        for (int p = 0; p < kPhaseCount; p++) {
+            if (!group->calls[p]) continue;
+            if (json) {
+                fprintf(out, "%s\n    {\"phase\": \"%s\", \"tid\": %d, \"calls\": %llu",
+                        first ? "" : ",", kPhaseNames[p], group->tid,
+                        (unsigned long long)group->calls[p]);
+            } else {
+                fprintf(out, "phase,%s,%d,%llu", kPhaseNames[p], group->tid,
+                        (unsigned long long)group->calls[p]);
+            }
+            values_out(group->phase[p]);
+            fprintf(out, json ? "}" : "\n");
+            first = false;
+        }
+    }
+    if (json) fprintf(out, "\n  ],\n  \"threads\": [");
+    first = true;
+    for (auto &group : registry) {
+        uint64_t values[kCounterCount];
+        thread_totals(*group, values);
+        if (json) {
+            fprintf(out, "%s\n    {\"name\": \"%s\", \"tid\": %d", first ? "" : ",",
+                    row_name(*group).c_str(), group->tid);
+        } else {
+            fprintf(out, "thread,%s,%d,", row_name(*group).c_str(), group->tid);
+        }
+        values_out(values);
+        fprintf(out, json ? "}" : "\n");
+        first = false;
+    }
+    if (json) fprintf(out, "\n  ]\n}\n");
+    bool ok = !ferror(out);
+    fclose(out);
+    return ok;
+}
@@ -0,0 +1,82 @@
+#ifndef __RRT_COUNTERS__
+#define __RRT_COUNTERS__
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "Trace.h"
+
+struct Backend;
+
+// Hardware and software counters from perf_event_open(2), one counter group per thread.
+// Off until counters_start(); a disabled CounterScope costs three relaxed atomic loads,
+// one each for the counters, the phase clock and its trace span.
+
+enum CounterEvent {
+    kCycles,
+    kInstructions,
+    kCacheMisses,
+    kBranchMisses,
+    kContextSwitches,
+    kTaskClock, // ns on cpu
+    kCounterCount
+};
+
+// Phases are inclusive: plan contains the kernels it calls, and a thread's numbers
+// contain the threads it started that have exited since (pthread kernel workers,
+// finished region threads).
+enum CounterPhase {
+    kPhasePlan,
+    kPhaseReplan,
+    kPhaseValidate,
+    kPhaseRoadmapBuild,
+    kPhaseRoadmapQuery,
+    kPhaseInflate,
+    kPhaseNearest,
+    kPhaseIntersection,
+    kPhaseCheckSegments,
+    kPhaseCount
+};
+
+struct ThreadCounters;
+
+// Counts one phase on the calling thread; the thread opens its group on first use.
+// The phase is also a span of the trace when tracing is on.
+class CounterScope {
+    public:
+        explicit CounterScope(CounterPhase _phase);
+        ~CounterScope();
+
+    private:
+        TraceScope trace;
+        bool timed = false; // phase clock was on at the start
+        uint64_t clock_start = 0;
+        ThreadCounters *self = nullptr;
+        CounterPhase phase;
+        uint64_t start[kCounterCount];
+};
+
+// Opens the counters of the calling thread and enables every scope. Events the machine
+// or kernel.perf_event_paranoid does not allow are reported as n/a; false (with a
+// message on stderr) when none can be opened at all.
+bool counters_start();
+bool counters_enabled();
+// Whole-thread counters for every thread of the process without a group yet (worker
+// pools created by the backends), counted from now on.
+void counters_attach_threads();
+
+// Wall-clock ns spent in every phase, summed over all threads since phase_clock_start().
+// Needs no perf_event access, for timing the kernels of single runs.
+void phase_clock_start();
+bool phase_clock_enabled();
+uint64_t phase_time_ns(CounterPhase phase);
+
+// inner with every kernel wrapped in a CounterScope; inner itself while the counters, the
+// phase clock and tracing are all off
+const Backend *counted_backend(const Backend *inner);
+
+void print_counters(FILE *out);
+// .json, anything else is written as CSV
+bool write_counters(const std::string &file_name);
+#endif
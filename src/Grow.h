@@ -0,0 +1,53 @@
+#ifndef __RRT_GROW__
+#define __RRT_GROW__
+
+// The single-tree growth rule, shared by Planner (2D, any backend) and rrt_nd::NdPlanner
+// (any dimension). The kernels only decide the order of the steps; the space they run
+// in supplies the geometry and the bookkeeping:
+//
+//   typedef ... Point;                             supports +, - and * by a scalar
+//   int nearest(const Point &p);                   node closest to p
+//   const Point &node(int idx) const;
+//   double distance(const Point &a, const Point &b) const;
+//   bool goal_free(const Point &a, const Point &b);  edge from a node to the goal
+//   bool sample(const Point &target, Point &out);  a sample, false when it is blocked
+//   double step();                                 random step length
+//   bool edge_free(const Point &a, const Point &b);  edge of one steered step
+//   int add(const Point &p, int parent);           index of the new node
+//   bool stop(int attempt);                        give up the current extension
+namespace rrt_grow {
+
+    // Connect target to its nearest node when that is closer than connect_dist and the
+    // edge is free. Returns the new node or -1.
+    template <typename Space>
+    int connect(Space &space, const typename Space::Point &target, double connect_dist) {
+        int near_idx = space.nearest(target);
+        const typename Space::Point &from = space.node(near_idx);
+        if (space.distance(from, target) >= connect_dist || !space.goal_free(from, target)) {
+            return -1;
+        }
+        return space.add(target, near_idx);
+    }
+
+    // Draw samples around target until one gives a new node: one random step from the
+    // nearest node towards a free sample, kept if the edge is free. Returns the new node,
+    // or -1 after max_attempts samples or when the space asks to stop.
+    template <typename Space>
+    int extend(Space &space, const typename Space::Point &target, int max_attempts) {
+        typedef typename Space::Point Point;
+        for (int attempt = 0; attempt < max_attempts; attempt++) {
+            if (space.stop(attempt)) break;
+            Point rand_pos;
+            if (!space.sample(target, rand_pos)) continue;
+            int near_idx = space.nearest(rand_pos);
+            const Point &from = space.node(near_idx);
+            double step_size = space.step();
+            double dist = space.distance(from, rand_pos);
+            if (dist < step_size) continue;
+            Point new_pos = from + (rand_pos - from) * (step_size / dist);
+            if (space.edge_free(from, new_pos)) return space.add(new_pos, near_idx);
+        }
+        return -1;
+    }
+} // namespace rrt_grow
+#endif
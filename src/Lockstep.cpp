@@ -0,0 +1,281 @@
+#include "Lockstep.h"
+
+#include <chrono>
+#include <limits>
+
+#include "Affinity.h"
+
+using namespace std::chrono;
+
+namespace {
+    // coordinate of unused tree slots, so the nearest scan needs no per-lane bound
+    const float kFar = 1e18f;
+    // draws per round for a lane to find a free sample
+    const int kSampleTries = 64;
+} // namespace
+
+template <int W>
+LockstepPlanner<W>::LockstepPlanner(const GridMap &_map, PlannerConfig _config, unsigned seed)
+    : map(_map), config(_config) {
+    // root, max_node grown nodes and the goal
+    const size_t capacity = (size_t)(config.max_node + 2) * W;
+    xs.assign(capacity, kFar);
+    ys.assign(capacity, kFar);
+    parents.resize(capacity);
+    std::mt19937 seeder(seed);
+    for (int l = 0; l < W; l++) {
+        rng[l] = seeder() | 1; // xorshift must not start at 0
+        query[l] = -1;
+        active[l] = 0;
+        check_goal[l] = 0;
+        count[l] = 0;
+        attempts[l] = 0;
+    }
+}
+
+template <int W>
+void LockstepPlanner<W>::start_lane(int l, int q, const Position &start, const Position &goal) {
+    // clear what the last query of this lane left behind
+    for (int i = 1; i < count[l]; i++) xs[(size_t)i * W + l] = ys[(size_t)i * W + l] = kFar;
+    xs[l] = start.x;
+    ys[l] = start.y;
+    parents[l] = -1;
+    count[l] = 1;
+    attempts[l] = 0;
+    goal_x[l] = goal.x;
+    goal_y[l] = goal.y;
+    goal_near[l] = 0;
+    goal_dist2[l] = (start.x - goal.x) * (start.x - goal.x) + (start.y - goal.y) * (start.y - goal.y);
+    query[l] = q;
+    started[l] = steady_clock::now();
+    active[l] = 1;
+    check_goal[l] = 1; // like Planner, try the goal from the root first
+}
+
+template <int W>
+void LockstepPlanner<W>::finish_lane(int l, bool success, LockstepResult &result) {
+    result.success = success;
+    result.nodes = count[l];
+    result.path.clear();
+    if (success) {
+        for (int i = count[l] - 1; i >= 0; i = parents[(size_t)i * W + l]) {
+            result.path.push_back(Position(xs[(size_t)i * W + l], ys[(size_t)i * W + l]));
+        }
+        reverse(result.path.begin(), result.path.end());
+    }
+    active[l] = 0;
+    query[l] = -1;
+}
+
+template <int W>
+void LockstepPlanner<W>::uniform(float *out) {
+#pragma omp simd
+    for (int l = 0; l < W; l++) {
+        uint32_t x = rng[l];
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        rng[l] = x;
+        out[l] = (x >> 8) * (1.0f / 16777216);
+    }
+}
+
+// The lanes of one node are contiguous, so every step of the scan is one vector compare.
+// Slots past the end of a shorter tree hold kFar and never win.
+template <int W>
+void LockstepPlanner<W>::nearest(const float *tx, const float *ty, const uint8_t *mask,
+                                 int *near_idx, float *near_dist2) const {
+    int longest = 0;
+    for (int l = 0; l < W; l++) {
+        if (mask[l]) longest = max(longest, count[l]);
+    }
+    alignas(64) float best[W];
+    alignas(64) int best_idx[W];
+    for (int l = 0; l < W; l++) {
+        best[l] = std::numeric_limits<float>::max();
+        best_idx[l] = 0;
+    }
+    for (int i = 0; i < longest; i++) {
+        const float *x = &xs[(size_t)i * W];
+        const float *y = &ys[(size_t)i * W];
+#pragma omp simd
+        for (int l = 0; l < W; l++) {
+            float dx = x[l] - tx[l], dy = y[l] - ty[l];
+            float dist = dx * dx + dy * dy;
+            bool better = dist < best[l];
+            best[l] = better ? dist : best[l];
+            best_idx[l] = better ? i : best_idx[l];
+        }
+    }
+    for (int l = 0; l < W; l++) {
+        near_idx[l] = best_idx[l];
+        near_dist2[l] = best[l];
+    }
+}
+
+// Same pixels as the backends' intersection(): point i of num is start + (int)(d * i / num).
+// Lanes past their last point read cell 0 and ignore it, which keeps the gather unmasked.
+template <int W>
+void LockstepPlanner<W>::check_segments(const float *sx, const float *sy, const float *ex,
+                                        const float *ey, const uint8_t *mask,
+                                        uint8_t *clear) const {
+    const GridMap &grid = local_map(map);
+    const uint8_t *cells = grid.cells.data();
+    const int width = grid.width;
+    alignas(64) float dx[W], dy[W];
+    alignas(64) int num[W], div[W];
+    int longest = -1;
+    for (int l = 0; l < W; l++) {
+        dx[l] = ex[l] - sx[l];
+        dy[l] = ey[l] - sy[l];
+        num[l] = mask[l] ? static_cast<int>(sqrtf(dx[l] * dx[l] + dy[l] * dy[l])) : -1;
+        div[l] = max(1, num[l]);
+        clear[l] = mask[l];
+        longest = max(longest, num[l]);
+    }
+    alignas(64) int idx[W];
+    alignas(64) uint8_t cell[W];
+    for (int i = 0; i <= longest; i++) {
+#pragma omp simd
+        for (int l = 0; l < W; l++) {
+            int x = sx[l] + static_cast<int>(dx[l] * i / div[l]);
+            int y = sy[l] + static_cast<int>(dy[l] * i / div[l]);
+            idx[l] = (y * width + x) * (i <= num[l]);
+        }
+        // the gather itself; only a single instruction with AVX2 or AVX-512
+        for (int l = 0; l < W; l++) cell[l] = cells[idx[l]];
+#pragma omp simd
+        for (int l = 0; l < W; l++) clear[l] &= (i > num[l]) | cell[l];
+        // every lane already blocked or done
+        if ((i & 15) == 15) {
+            bool pending = false;
+            for (int l = 0; l < W; l++) pending |= clear[l] && i < num[l];
+            if (!pending) break;
+        }
+    }
+}
+
+template <int W>
+void LockstepPlanner<W>::solve(const vector<Position> &starts, const vector<Position> &goals,
+                               vector<LockstepResult> &results) {
+    const int total = starts.size();
+    results.assign(total, LockstepResult());
+    int next = 0;
+    for (int l = 0; l < W && next < total; l++, next++) start_lane(l, next, starts[next], goals[next]);
+
+    const GridMap &grid = local_map(map);
+    const float step_size = config.step_size;
+    const float min_step = max(15.0f, step_size / 5);
+    const float connect2 = 1.5f * step_size * 1.5f * step_size;
+    const float width = grid.width, height = grid.height;
+    // sum of four uniforms, centred and scaled to unit variance
+    const float normal_scale = sqrtf(3.0f) * config.std;
+    alignas(64) float tx[W], ty[W], px[W], py[W], cx[W], cy[W], dist2[W], u[4][W];
+    alignas(64) int near_idx[W], cell_idx[W];
+    alignas(64) uint8_t mask[W], clear[W], need[W], drawn[W], cell[W];
+
+    for (;;) {
+        bool running = false;
+        for (int l = 0; l < W; l++) running |= active[l];
+        if (!running) break;
+
+        // goal connection from the node nearest to the goal, for every lane that grew
+#pragma omp simd
+        for (int l = 0; l < W; l++) {
+            mask[l] = active[l] & check_goal[l] & (goal_dist2[l] < connect2);
+            near_idx[l] = goal_near[l];
+            px[l] = xs[(size_t)goal_near[l] * W + l];
+            py[l] = ys[(size_t)goal_near[l] * W + l];
+        }
+        check_segments(px, py, goal_x, goal_y, mask, clear);
+        for (int l = 0; l < W; l++) {
+            if (!active[l]) continue;
+            check_goal[l] = 0;
+            bool reached = mask[l] && clear[l];
+            if (reached) {
+                size_t slot = (size_t)count[l]++ * W + l;
+                xs[slot] = goal_x[l];
+                ys[slot] = goal_y[l];
+                parents[slot] = near_idx[l];
+            }
+            if (!reached && count[l] <= config.max_node && attempts[l] < config.max_iter) continue;
+            LockstepResult &result = results[query[l]];
+            finish_lane(l, reached, result);
+            result.seconds = duration_cast<duration<float>>(steady_clock::now() - started[l]).count();
+            if (next < total) {
+                start_lane(l, next, starts[next], goals[next]);
+                next++;
+            }
+        }
+
+        // a free sample for every lane still searching. Points outside the map are redrawn
+        // like random_position() does; blocked ones are failed attempts, as in Planner,
+        // and the lane draws again so that the nearest scan has every lane busy.
+        for (int l = 0; l < W; l++) {
+            need[l] = active[l] && !check_goal[l];
+            mask[l] = 0;
+        }
+        for (int tries = 0; tries < kSampleTries; tries++) {
+            for (int k = 0; k < 4; k++) uniform(u[k]);
+#pragma omp simd
+            for (int l = 0; l < W; l++) {
+                cx[l] = goal_x[l] + (u[0][l] + u[1][l] + u[2][l] + u[3][l] - 2) * normal_scale;
+            }
+            for (int k = 0; k < 4; k++) uniform(u[k]);
+#pragma omp simd
+            for (int l = 0; l < W; l++) {
+                cy[l] = goal_y[l] + (u[0][l] + u[1][l] + u[2][l] + u[3][l] - 2) * normal_scale;
+                int inside = (cx[l] >= 0) & (cx[l] < width) & (cy[l] >= 0) & (cy[l] < height);
+                cell_idx[l] = ((int)cy[l] * grid.width + (int)cx[l]) * inside;
+                drawn[l] = need[l] & inside;
+            }
+            for (int l = 0; l < W; l++) cell[l] = grid.cells[cell_idx[l]];
+            bool pending = false;
+#pragma omp simd reduction(| : pending)
+            for (int l = 0; l < W; l++) {
+                uint8_t found = drawn[l] & (cell[l] != 0);
+                attempts[l] += drawn[l];
+                tx[l] = found ? cx[l] : tx[l];
+                ty[l] = found ? cy[l] : ty[l];
+                mask[l] |= found;
+                need[l] &= !found;
+                pending |= need[l];
+            }
+            if (!pending) break;
+        }
+
+        // steer one random step from the nearest node towards the sample
+        nearest(tx, ty, mask, near_idx, dist2);
+        uniform(u[0]);
+#pragma omp simd
+        for (int l = 0; l < W; l++) {
+            float step = min_step + (step_size - min_step) * u[0][l];
+            float dist = sqrtf(dist2[l]);
+            mask[l] = mask[l] && dist >= step;
+            px[l] = xs[(size_t)near_idx[l] * W + l];
+            py[l] = ys[(size_t)near_idx[l] * W + l];
+            float scale = mask[l] ? step / dist : 0;
+            tx[l] = px[l] + (tx[l] - px[l]) * scale;
+            ty[l] = py[l] + (ty[l] - py[l]) * scale;
+        }
+        check_segments(px, py, tx, ty, mask, clear);
+        for (int l = 0; l < W; l++) {
+            if (!clear[l]) continue;
+            size_t slot = (size_t)count[l]++ * W + l;
+            xs[slot] = tx[l];
+            ys[slot] = ty[l];
+            parents[slot] = near_idx[l];
+            attempts[l] = 0;
+            check_goal[l] = 1;
+            float dx = tx[l] - goal_x[l], dy = ty[l] - goal_y[l];
+            if (dx * dx + dy * dy < goal_dist2[l]) {
+                goal_dist2[l] = dx * dx + dy * dy;
+                goal_near[l] = count[l] - 1;
+            }
+        }
+    }
+}
+
+// 16 lanes were slower than one query after another: every round waits for the
+// slowest of more lanes, and every scan runs to the longest of more trees.
+template class LockstepPlanner<8>;
@@ -0,0 +1,62 @@
+#ifndef __RRT_LOCKSTEP__
+#define __RRT_LOCKSTEP__
+
+#include "Planner.h"
+
+struct LockstepResult {
+        bool success = false;
+        int nodes = 0;
+        vector<Position> path; // start -> goal, empty on failure
+        float seconds = 0;     // from the moment a lane took the query until it finished
+};
+
+// Many small queries on one map, W of them in lockstep: one query per SIMD lane.
+// Every tree is stored node-major with the W lanes of a node side by side, so the
+// nearest search, steering, sampling and the pixel gathers of a collision check are
+// one `omp simd` loop over the lanes. Lanes are masked while they wait, and a lane
+// whose query finishes takes the next one at once.
+//
+// The growth rule is Planner's with batch_size 1. Samples come from a per-lane
+// xorshift generator; the normal around the goal is a sum of four uniforms.
+template <int W>
+class LockstepPlanner {
+    public:
+        LockstepPlanner(const GridMap &_map, PlannerConfig _config,
+                        unsigned seed = random_device{}());
+
+        // results[q] for the query starts[q] -> goals[q]
+        void solve(const vector<Position> &starts, const vector<Position> &goals,
+                   vector<LockstepResult> &results);
+
+    private:
+        void start_lane(int l, int query, const Position &start, const Position &goal);
+        void finish_lane(int l, bool success, LockstepResult &result);
+        // nearest node of every lane in mask to (tx[l], ty[l])
+        void nearest(const float *tx, const float *ty, const uint8_t *mask, int *near_idx,
+                     float *near_dist2) const;
+        // clear[l] = 1 when the segment of lane l misses every obstacle
+        void check_segments(const float *sx, const float *sy, const float *ex, const float *ey,
+                            const uint8_t *mask, uint8_t *clear) const;
+        void uniform(float *out); // next value of every lane generator in [0, 1)
+
+        const GridMap &map;
+        PlannerConfig config;
+        // trees, node-major: node i of lane l at [i * W + l]
+        vector<float> xs;
+        vector<float> ys;
+        vector<int> parents;
+        // per-lane state
+        alignas(64) float goal_x[W];
+        alignas(64) float goal_y[W];
+        // node closest to the goal so far, kept up to date as nodes are added
+        alignas(64) int goal_near[W];
+        alignas(64) float goal_dist2[W];
+        alignas(64) int count[W];        // nodes in the tree
+        alignas(64) int attempts[W];     // samples since the last node was added
+        alignas(64) int query[W];        // query of the lane, -1 when idle
+        alignas(64) uint8_t active[W];
+        alignas(64) uint8_t check_goal[W]; // grew since the last goal check
+        alignas(64) uint32_t rng[W];
+        std::chrono::steady_clock::time_point started[W]; // when the lane took its query
+};
+#endif
@@ -0,0 +1,13 @@
+#ifndef __RRT_MAPS__
+#define __RRT_MAPS__
+
+#include "Util.h"
+
+// Built-in test maps selected with -m, with their start and target positions
+inline const string _map_names[] = {"res/map.png", "res/maze1.png", "res/maze2.png", "res/maze3.png", "res/maze2_mid.png", "res/maze2_big.png"};
+inline const Position _startposs[] = {Position(1235, 330), Position(10, 445), Position(20, 405),
+                                      Position(1265, 65), Position(20, 405)*2.5, Position(20, 405)*4};
+inline const Position _targetposs[] = {Position(390, 665), Position(585, 975), Position(215, 975),
+                                       Position(180, 945), Position(215, 975)*2.5, Position(215, 975)*4};
+inline const int _map_count = 6;
+#endif
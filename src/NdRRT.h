@@ -0,0 +1,329 @@
+#ifndef __RRT_ND__
+#define __RRT_ND__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Grow.h"
+
+// N-dimensional RRT core. Everything is templated on the scalar type and the dimension,
+// so distance, steering and voxel traversal have compile-time trip counts that the
+// compiler unrolls; nothing branches on the dimension at run time. NdPlanner<float, 2>
+// runs on the same maps as Planner, NdPlanner<float, 3> on voxel volumes.
+namespace rrt_nd {
+
+    template <typename T, int N>
+    struct Vec {
+            T v[N];
+
+            constexpr T &operator[](int i) { return v[i]; }
+            constexpr const T &operator[](int i) const { return v[i]; }
+            constexpr Vec operator+(const Vec &other) const {
+                Vec out{};
+                for (int i = 0; i < N; i++) out.v[i] = v[i] + other.v[i];
+                return out;
+            }
+            constexpr Vec operator-(const Vec &other) const {
+                Vec out{};
+                for (int i = 0; i < N; i++) out.v[i] = v[i] - other.v[i];
+                return out;
+            }
+            constexpr Vec operator*(T mul) const {
+                Vec out{};
+                for (int i = 0; i < N; i++) out.v[i] = v[i] * mul;
+                return out;
+            }
+    };
+
+    template <typename T, int N>
+    constexpr T squared_distance(const Vec<T, N> &a, const Vec<T, N> &b) {
+        T sum = 0;
+        for (int i = 0; i < N; i++) {
+            T d = a[i] - b[i];
+            sum += d * d;
+        }
+        return sum;
+    }
+
+    template <typename T, int N>
+    inline T distance(const Vec<T, N> &a, const Vec<T, N> &b) {
+        return std::sqrt(squared_distance(a, b));
+    }
+
+    // Occupancy grid with one bit per voxel (1 = free). Axis 0 varies fastest, which is
+    // also the order of a raw volume file.
+    template <int N>
+    class VoxelGrid {
+        public:
+            VoxelGrid() = default;
+            explicit VoxelGrid(const int (&_dims)[N]) {
+                size_t total = 1;
+                for (int i = 0; i < N; i++) {
+                    dims[i] = _dims[i];
+                    strides[i] = total;
+                    total *= dims[i];
+                }
+                cells = total;
+                words.assign((total + 63) / 64, ~uint64_t(0));
+            }
+
+            int dim(int axis) const { return dims[axis]; }
+            size_t size() const { return cells; }
+            size_t stride(int axis) const { return strides[axis]; }
+
+            template <typename T>
+            bool inside(const Vec<T, N> &p) const {
+                for (int i = 0; i < N; i++) {
+                    if (!(p[i] >= 0 && p[i] < dims[i])) return false;
+                }
+                return true;
+            }
+            template <typename T>
+            size_t index_of(const Vec<T, N> &p) const {
+                size_t idx = 0;
+                for (int i = 0; i < N; i++) idx += static_cast<size_t>(p[i]) * strides[i];
+                return idx;
+            }
+            bool free(size_t idx) const { return (words[idx >> 6] >> (idx & 63)) & 1; }
+            template <typename T>
+            bool free(const Vec<T, N> &p) const {
+                return free(index_of(p));
+            }
+            void set(size_t idx, bool is_free) {
+                if (is_free) {
+                    words[idx >> 6] |= uint64_t(1) << (idx & 63);
+                } else {
+                    words[idx >> 6] &= ~(uint64_t(1) << (idx & 63));
+                }
+            }
+
+            // Grow every obstacle by radius voxels along each axis (a cube, like the square
+            // of the 2D inflation). The dilation is separable, so it is one pass per axis.
+            void inflate(int radius) {
+                if (radius <= 0) return;
+                std::vector<uint8_t> line;
+                for (int axis = 0; axis < N; axis++) {
+                    const size_t step = strides[axis], block = step * dims[axis];
+                    const int length = dims[axis];
+                    line.resize(length);
+                    for (size_t outer = 0; outer < cells; outer += block) {
+                        for (size_t inner = 0; inner < step; inner++) {
+                            const size_t base = outer + inner;
+                            for (int k = 0; k < length; k++) line[k] = free(base + k * step);
+                            // distance to the closest obstacle seen so far, forward then back
+                            int last = -radius - 1;
+                            for (int k = 0; k < length; k++) {
+                                if (!line[k]) last = k;
+                                if (k - last <= radius) set(base + k * step, false);
+                            }
+                            last = length + radius;
+                            for (int k = length - 1; k >= 0; k--) {
+                                if (!line[k]) last = k;
+                                if (last - k <= radius) set(base + k * step, false);
+                            }
+                        }
+                    }
+                }
+            }
+
+            // raw volume of dims[0] x ... x dims[N-1] bytes, values below threshold are
+            // obstacles
+            static bool load_raw(const std::string &file_name, const int (&_dims)[N],
+                                 uint8_t threshold, VoxelGrid &out) {
+                FILE *in = fopen(file_name.c_str(), "rb");
+                if (!in) {
+                    fprintf(stderr, "cannot open %s\n", file_name.c_str());
+                    return false;
+                }
+                out = VoxelGrid(_dims);
+                std::vector<uint8_t> chunk(1 << 16);
+                size_t idx = 0;
+                while (idx < out.cells) {
+                    size_t got = fread(chunk.data(), 1, std::min(chunk.size(), out.cells - idx), in);
+                    if (got == 0) break;
+                    for (size_t k = 0; k < got; k++, idx++) {
+                        if (chunk[k] < threshold) out.set(idx, false);
+                    }
+                }
+                fclose(in);
+                if (idx < out.cells) {
+                    fprintf(stderr, "%s holds %zu voxels, expected %zu\n", file_name.c_str(), idx,
+                            out.cells);
+                    return false;
+                }
+                return true;
+            }
+
+        private:
+            int dims[N] = {};
+            size_t strides[N] = {};
+            size_t cells = 0;
+            std::vector<uint64_t> words;
+    };
+
+    // Amanatides-Woo traversal: visits every voxel the segment a-b passes through, in
+    // order, and stops at the first occupied one. Both ends must be inside the grid.
+    template <typename T, int N>
+    bool segment_free(const VoxelGrid<N> &grid, const Vec<T, N> &a, const Vec<T, N> &b) {
+        const T inf = std::numeric_limits<T>::infinity();
+        T t_max[N], t_delta[N];
+        long long step[N];
+        int remaining = 0;
+        for (int i = 0; i < N; i++) {
+            int from = static_cast<int>(a[i]), to = static_cast<int>(b[i]);
+            remaining += from < to ? to - from : from - to;
+            T d = b[i] - a[i];
+            if (d > 0) {
+                step[i] = static_cast<long long>(grid.stride(i));
+                t_delta[i] = 1 / d;
+                t_max[i] = (from + 1 - a[i]) / d;
+            } else if (d < 0) {
+                step[i] = -static_cast<long long>(grid.stride(i));
+                t_delta[i] = -1 / d;
+                t_max[i] = (a[i] - from) / -d;
+            } else {
+                step[i] = 0;
+                t_delta[i] = inf;
+                t_max[i] = inf;
+            }
+        }
+        // the box is convex, so the linear index can simply be walked along
+        size_t idx = grid.index_of(a);
+        if (!grid.free(idx)) return false;
+        for (; remaining > 0; remaining--) {
+            int axis = 0;
+            for (int i = 1; i < N; i++) {
+                if (t_max[i] < t_max[axis]) axis = i;
+            }
+            idx += step[axis];
+            t_max[axis] += t_delta[axis];
+            if (!grid.free(idx)) return false;
+        }
+        return true;
+    }
+
+    // Single-tree RRT over a VoxelGrid. The growth rule is Planner's with batch_size 1, run
+    // by the same Grow.h kernels: try to connect the goal from the nearest node, otherwise
+    // sample around the goal and take one randomly sized step from the nearest node.
+    // Only the geometry (nearest scan, voxel traversal, sampling) lives here.
+    template <typename T, int N>
+    class NdPlanner {
+        public:
+            typedef Vec<T, N> Point;
+
+            struct Config {
+                    T step_size = 50;
+                    T std = 1000;
+                    int max_node = 100000;
+                    int max_iter = 250000;
+            };
+
+            NdPlanner(const VoxelGrid<N> &_grid, Config _config, unsigned seed)
+                : grid(_grid), config(_config), generator(seed) {
+                nodes.reserve(config.max_node + 1);
+                parents.reserve(config.max_node + 1);
+            }
+
+            bool plan(const Point &start, const Point &goal) {
+                nodes.clear();
+                parents.clear();
+                path_.clear();
+                found = false;
+                if (!grid.inside(start) || !grid.inside(goal) || !grid.free(start)) return false;
+                nodes.push_back(start);
+                parents.push_back(-1);
+                Space space = {*this, std::uniform_real_distribution<T>(
+                                          std::max(T(15), config.step_size / 5), config.step_size)};
+                for (int i = 0; i < config.max_iter && (int)nodes.size() < config.max_node; i++) {
+                    if (rrt_grow::connect(space, goal, T(1.5) * config.step_size) >= 0) {
+                        found = true;
+                        break;
+                    }
+                    rrt_grow::extend(space, goal, config.max_iter);
+                }
+                if (found) {
+                    for (int idx = (int)nodes.size() - 1; idx >= 0; idx = parents[idx]) {
+                        path_.push_back(nodes[idx]);
+                    }
+                    std::reverse(path_.begin(), path_.end());
+                }
+                return found;
+            }
+
+            const std::vector<Point> &tree() const { return nodes; }
+            const std::vector<int> &tree_parents() const { return parents; }
+            const std::vector<Point> &path() const { return path_; }
+            bool success() const { return found; }
+
+        private:
+            // what the Grow.h kernels see of this planner
+            struct Space {
+                    typedef Vec<T, N> Point;
+                    NdPlanner &planner;
+                    std::uniform_real_distribution<T> steps;
+
+                    int nearest(const Point &pos) const { return planner.nearest(pos); }
+                    const Point &node(int idx) const { return planner.nodes[idx]; }
+                    double distance(const Point &a, const Point &b) const {
+                        return rrt_nd::distance(a, b);
+                    }
+                    bool goal_free(const Point &from, const Point &goal) const {
+                        return segment_free(planner.grid, from, goal);
+                    }
+                    bool sample(const Point &target, Point &out) {
+                        out = planner.sample(target);
+                        return planner.grid.free(out);
+                    }
+                    double step() { return steps(planner.generator); }
+                    bool edge_free(const Point &start, const Point &end) const {
+                        return segment_free(planner.grid, start, end);
+                    }
+                    int add(const Point &pos, int parent) {
+                        planner.nodes.push_back(pos);
+                        planner.parents.push_back(parent);
+                        return (int)planner.nodes.size() - 1;
+                    }
+                    bool stop(int) const { return false; }
+            };
+
+            int nearest(const Point &target) const {
+                T min_dist = std::numeric_limits<T>::max();
+                int min_node = 0;
+                for (int i = 0; i < (int)nodes.size(); i++) {
+                    T dist = squared_distance(nodes[i], target);
+                    if (dist < min_dist) {
+                        min_dist = dist;
+                        min_node = i;
+                    }
+                }
+                return min_node;
+            }
+
+            // normal around the goal on every axis, redrawn until inside, like random_position
+            Point sample(const Point &goal) {
+                Point pos{};
+                for (int i = 0; i < N; i++) {
+                    std::normal_distribution<T> axis(goal[i], config.std);
+                    do {
+                        pos[i] = axis(generator);
+                    } while (!(pos[i] >= 0 && pos[i] < grid.dim(i)));
+                }
+                return pos;
+            }
+
+            const VoxelGrid<N> &grid;
+            Config config;
+            std::mt19937 generator;
+            std::vector<Point> nodes;
+            std::vector<int> parents;
+            std::vector<Point> path_;
+            bool found = false;
+    };
+} // namespace rrt_nd
+#endif
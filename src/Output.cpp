@@ -0,0 +1,97 @@
+#include "Output.h"
+
+#include <cstdint>
+#include <cstring>
+
+bool write_tree_binary(const string &file_name, const TreeSnapshot &snapshot) {
+    FILE *out = fopen(file_name.c_str(), "wb");
+    if (!out) {
+        fprintf(stderr, "cannot open %s for writing\n", file_name.c_str());
+        return false;
+    }
+    uint32_t header[5] = {0, 1, (uint32_t)snapshot.tree.size(), (uint32_t)snapshot.path.size(),
+                          snapshot.success};
+    memcpy(&header[0], "RRTB", 4);
+    float ends[4] = {snapshot.start.x, snapshot.start.y, snapshot.goal.x, snapshot.goal.y};
+    fwrite(header, sizeof(header), 1, out);
+    fwrite(ends, sizeof(ends), 1, out);
+    for (int i = 0; i < snapshot.tree.size(); i++) {
+        struct {
+                float x, y;
+                int32_t parent;
+        } node = {snapshot.tree.pos[i].x, snapshot.tree.pos[i].y, snapshot.tree.parent[i]};
+        fwrite(&node, sizeof(node), 1, out);
+    }
+    for (const Position &pos : snapshot.path) {
+        float xy[2] = {pos.x, pos.y};
+        fwrite(xy, sizeof(xy), 1, out);
+    }
+    bool ok = !ferror(out);
+    fclose(out);
+    return ok;
+}
+
+OutputWriter::OutputWriter(const Mat &_background, string _plot_name, string _export_prefix)
+    : background(_background), plot_name(_plot_name), export_prefix(_export_prefix) {
+    thread = std::thread(&OutputWriter::worker, this);
+}
+
+OutputWriter::~OutputWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    cv.notify_one();
+    thread.join();
+    for (TreeSnapshot *snapshot : spare) delete snapshot;
+}
+
+void OutputWriter::submit(const TreeStore &tree, const vector<Position> &path, Position start,
+                          Position goal, bool success, int run) {
+    TreeSnapshot *snapshot = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!spare.empty()) {
+            snapshot = spare.back();
+            spare.pop_back();
+        }
+    }
+    if (!snapshot) snapshot = new TreeSnapshot();
+    // vector assignment reuses the snapshot's capacity
+    snapshot->tree.pos = tree.pos;
+    snapshot->tree.parent = tree.parent;
+    snapshot->path = path;
+    snapshot->start = start;
+    snapshot->goal = goal;
+    snapshot->success = success;
+    snapshot->run = run;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(snapshot);
+    }
+    cv.notify_one();
+}
+
+void OutputWriter::write(const TreeSnapshot &snapshot) {
+    if (!plot_name.empty()) {
+        plot(background.clone(), snapshot.tree, snapshot.start, snapshot.goal, snapshot.path,
+             snapshot.run ? plot_name + "_" + to_string(snapshot.run) : plot_name);
+    }
+    if (!export_prefix.empty()) {
+        write_tree_binary(export_prefix + "_" + to_string(snapshot.run) + ".rrt", snapshot);
+    }
+}
+
+void OutputWriter::worker() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv.wait(lock, [this] { return done || !queue.empty(); });
+        if (queue.empty()) break;
+        TreeSnapshot *snapshot = queue.front();
+        queue.pop_front();
+        lock.unlock();
+        write(*snapshot);
+        lock.lock();
+        spare.push_back(snapshot);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef __RRT_OUTPUT__
+#define __RRT_OUTPUT__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "Util.h"
+
+// Copy of one finished query, owned by the output thread while it is written.
+struct TreeSnapshot {
+        TreeStore tree;
+        vector<Position> path;
+        Position start;
+        Position goal;
+        bool success = false;
+        int run = 0;
+};
+
+// Binary tree/trace dump, little-endian:
+//   char[4] "RRTB", uint32 version, uint32 node_count, uint32 path_len,
+//   uint32 success, float start_x, start_y, goal_x, goal_y,
+//   node_count x {float x, float y, int32 parent}  -- in insertion order, root first
+//   path_len x {float x, float y}                 -- start to goal
+bool write_tree_binary(const string &file_name, const TreeSnapshot &snapshot);
+
+// Background writer: submit() only copies the tree and path into a recycled snapshot,
+// rendering, PNG encoding and file writes happen on the writer thread.
+class OutputWriter {
+    public:
+        // empty plot_name / export_prefix turn that output off
+        OutputWriter(const Mat &_background, string _plot_name, string _export_prefix);
+        ~OutputWriter(); // writes everything still queued
+
+        void submit(const TreeStore &tree, const vector<Position> &path, Position start,
+                    Position goal, bool success, int run);
+
+    private:
+        void worker();
+        void write(const TreeSnapshot &snapshot);
+
+        Mat background;
+        string plot_name;
+        string export_prefix;
+        std::deque<TreeSnapshot *> queue;
+        vector<TreeSnapshot *> spare; // written snapshots, reused to keep their buffers
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool done = false;
+        std::thread thread;
+};
+#endif
@@ -0,0 +1,213 @@
+#include "Partition.h"
+
+#include <thread>
+
+#include "Affinity.h"
+#include "Counters.h"
+#include "Planner.h"
+
+using namespace rrt_utils;
+
+HandoffRing::HandoffRing(int capacity_pow2)
+    : slots(new Handoff[capacity_pow2]), mask(capacity_pow2 - 1) {}
+
+bool HandoffRing::push(const Handoff &item) {
+    unsigned t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) > mask) return false;
+    slots[t & mask] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+bool HandoffRing::pop(Handoff &item) {
+    unsigned h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) return false;
+    item = slots[h & mask];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+namespace {
+    // region threads check for stalls, cancellation and the deadline every this many samples
+    const int kCheckInterval = 64;
+} // namespace
+
+// Grow the subtree of strip r until some strip connects the goal, the node budget is
+// used up, every strip has retired, the query is cancelled or its deadline passes. Nothing
+// here is shared with the other strips except the handoff rings, the two counters and the
+// two flags.
+void Planner::region_worker(int r, Position target, std::atomic<bool> &stop,
+                            std::atomic<int> &winner, std::atomic<int> &node_total,
+                            std::atomic<int> &retired) {
+    TraceScope trace("region");
+    pin_current_thread(r);
+    RegionState &own = *regions_[r];
+    const int count = regions_.size();
+    const float step_size = config_.step_size;
+    const float extent = split_axis ? grid.height : grid.width;
+    uniform_real_distribution<double> distribution(max(15.0f, step_size / 5), step_size);
+    // samples reach one step into the neighbours, or no extension could ever leave the strip
+    const float reach_lo = max(0.0f, own.lo - step_size);
+    const float reach_hi = min(extent - 1, own.hi + step_size);
+    uniform_real_distribution<float> across(reach_lo, reach_hi);
+
+    // add a node to this strip and try to connect the goal from it; every strip draws
+    // from the same budget, so the merged tree never exceeds max_node
+    auto add_node = [&](const Position &pos, int parent) {
+        if (node_total.fetch_add(1, std::memory_order_relaxed) >= config_.max_node) {
+            stop.store(true, std::memory_order_relaxed);
+            return;
+        }
+        int idx = own.tree.add(pos, parent);
+        own.attempts = 0;
+        if (own.retired) {
+            own.retired = false;
+            retired.fetch_sub(1, std::memory_order_relaxed);
+        }
+        if (distance(pos, target) >= 1.5 * step_size) return;
+        own.pixels += static_cast<int>(distance(pos, target)) + 1;
+        if (!backend->intersection(grid, pos, target)) {
+            int expected = -1;
+            if (winner.compare_exchange_strong(expected, region_node_id(r, idx))) {
+                stop.store(true, std::memory_order_relaxed);
+            }
+        }
+    };
+    auto strip_of = [&](const Position &pos) {
+        float v = split_axis ? pos.y : pos.x;
+        return min(count - 1, max(0, static_cast<int>(v * count / extent)));
+    };
+
+    for (int iter = 0; !stop.load(std::memory_order_relaxed); iter++) {
+        Handoff handoff;
+        while (own.from_prev.pop(handoff)) add_node(handoff.pos, handoff.parent);
+        while (own.from_next.pop(handoff)) add_node(handoff.pos, handoff.parent);
+
+        if (iter % kCheckInterval == 0 && should_stop()) {
+            stop.store(true, std::memory_order_relaxed);
+            break;
+        }
+        if (own.attempts >= config_.max_iter) {
+            // A strip stuck in a dead-end pocket retires only itself, the others may still
+            // be getting closer to the goal. The query fails once all of them are stuck.
+            own.attempts = 0;
+            own.retired = true;
+            if (retired.fetch_add(1, std::memory_order_relaxed) + 1 == count) {
+                stop.store(true, std::memory_order_relaxed);
+            }
+        }
+        if (own.retired) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        own.attempts++;
+        Position rand_pos = random_position(target, config_.std, grid.width, grid.height,
+                                            own.generator);
+        float &along = split_axis ? rand_pos.y : rand_pos.x;
+        if (along < reach_lo || along > reach_hi) {
+            // samples far inside other strips would only pull this subtree to its border
+            along = across(own.generator);
+        }
+        own.pixels++;
+        if (!grid[(int)rand_pos.y][(int)rand_pos.x]) continue;
+        int near_idx = backend->nearest(own.tree.pos.data(), own.tree.size(), rand_pos);
+        Position new_pos;
+        if (!steer(own.tree.pos[near_idx], rand_pos, distribution(own.generator), new_pos,
+                   own.pixels)) {
+            continue;
+        }
+        int owner = strip_of(new_pos);
+        Handoff out = {new_pos, region_node_id(r, near_idx)};
+        if (owner == r) {
+            add_node(new_pos, out.parent);
+        } else if (owner == r - 1) {
+            if (!regions_[owner]->from_next.push(out)) own.dropped++;
+        } else if (owner == r + 1) {
+            if (!regions_[owner]->from_prev.push(out)) own.dropped++;
+        }
+    }
+}
+
+// Domain decomposition: one thread and one subtree per strip, then the subtrees are
+// merged into nodes in breadth-first order from the root, so path(), tree(), replanning
+// and the exports see an ordinary tree with every parent before its children.
+bool Planner::grow_partitioned(Position start, Position target) {
+    // strips narrower than two steps would hand most nodes over
+    const float extent = max(grid.width, grid.height);
+    split_axis = grid.height > grid.width;
+    int count = max(1, min(config_.regions, static_cast<int>(extent / (2 * config_.step_size))));
+    if (regions_.size() != (size_t)count) {
+        regions_.clear();
+        for (int r = 0; r < count; r++) {
+            regions_.emplace_back(new RegionState());
+            regions_[r]->tree.reserve(config_.max_node + 1);
+        }
+    }
+    for (int r = 0; r < count; r++) {
+        RegionState &region = *regions_[r];
+        region.tree.clear();
+        region.lo = extent * r / count;
+        region.hi = extent * (r + 1) / count;
+        region.generator.seed(generator());
+        region.attempts = 0;
+        region.dropped = 0;
+        region.pixels = 0;
+        Handoff drain;
+        while (region.from_prev.pop(drain)) {}
+        while (region.from_next.pop(drain)) {}
+    }
+    float start_v = split_axis ? start.y : start.x;
+    int start_region = min(count - 1, static_cast<int>(start_v * count / extent));
+    regions_[start_region]->tree.add(start, -1);
+    // strips without a node wait for a handoff, like retired ones
+    for (int r = 0; r < count; r++) regions_[r]->retired = r != start_region;
+
+    // the strips are the parallelism, kernels run serially inside each of them
+    const Backend *kernels = backend;
+    backend = counted_backend(&serial_backend);
+    active_map = &grid;
+    std::atomic<bool> stop{false};
+    std::atomic<int> winner{-1};
+    std::atomic<int> node_total{1}; // the root
+    std::atomic<int> retired{count - 1};
+    vector<std::thread> threads;
+    for (int r = 1; r < count; r++) {
+        threads.emplace_back(&Planner::region_worker, this, r, target, std::ref(stop),
+                             std::ref(winner), std::ref(node_total), std::ref(retired));
+    }
+    region_worker(0, target, stop, winner, node_total, retired);
+    for (std::thread &thread : threads) thread.join();
+    backend = kernels;
+
+    // concatenate the subtrees, start strip first so the root stays node 0
+    vector<int> offset(count, 0);
+    int total = 0;
+    for (int k = 0; k < count; k++) {
+        int r = (start_region + k) % count;
+        offset[r] = total;
+        total += regions_[r]->tree.size();
+    }
+    nodes.clear();
+    for (int k = 0; k < count; k++) {
+        const TreeStore &tree = regions_[(start_region + k) % count]->tree;
+        for (int idx = 0; idx < tree.size(); idx++) {
+            int parent = tree.parent[idx];
+            nodes.add(tree.pos[idx],
+                      parent < 0 ? -1 : offset[region_of_id(parent)] + index_of_id(parent));
+        }
+    }
+    // a handoff can make a node of a later strip the parent of an earlier one
+    sort_parent_first();
+    n_count = nodes.size();
+    for (const auto &region : regions_) pixels += region->pixels;
+    int goal_id = winner.load();
+    if (goal_id < 0) return false;
+    nodes.add(target, remap[offset[region_of_id(goal_id)] + index_of_id(goal_id)]);
+    if (config_.verbose > 0) {
+        int dropped = 0;
+        for (const auto &region : regions_) dropped += region->dropped;
+        printf("Domain decomposition: %d strips, %d handoffs dropped\n", count, dropped);
+    }
+    return true;
+}
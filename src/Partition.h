@@ -0,0 +1,56 @@
+#ifndef __RRT_PARTITION__
+#define __RRT_PARTITION__
+
+#include <atomic>
+#include <memory>
+
+#include "Util.h"
+
+// State of the domain-decomposition mode (PlannerConfig::regions > 1). The map is cut
+// into strips along its longer side, one per thread. Every strip keeps its own subtree
+// and only searches that for nearest nodes; an extension that crosses into a neighbour
+// strip is pushed into that neighbour's inbox instead of being added locally.
+
+// a node for the neighbour's tree; parent is a node id of the sending region
+struct Handoff {
+        Position pos;
+        int parent;
+};
+
+// Bounded single-producer single-consumer ring. A full ring drops the handoff, which
+// only costs the tree one node.
+class HandoffRing {
+    public:
+        explicit HandoffRing(int capacity_pow2);
+
+        bool push(const Handoff &item);
+        bool pop(Handoff &item);
+
+    private:
+        std::unique_ptr<Handoff[]> slots;
+        unsigned mask;
+        alignas(64) std::atomic<unsigned> head{0}; // next slot the consumer reads
+        alignas(64) std::atomic<unsigned> tail{0}; // next slot the producer writes
+};
+
+// Node ids name a node of any region: region in the high bits, index in its tree below.
+const int kRegionShift = 24;
+inline int region_node_id(int region, int idx) { return (region << kRegionShift) | idx; }
+inline int region_of_id(int id) { return id >> kRegionShift; }
+inline int index_of_id(int id) { return id & ((1 << kRegionShift) - 1); }
+
+struct alignas(64) RegionState {
+        // parent entries are region node ids, -1 for the root
+        TreeStore tree;
+        std::mt19937 generator;
+        float lo = 0, hi = 0; // extent along the split axis
+        // handoffs from the previous and next strip
+        HandoffRing from_prev{1024};
+        HandoffRing from_next{1024};
+        int attempts = 0; // samples since the last node was added
+        // stalled, or no node yet: only handoffs are taken until one revives the strip
+        bool retired = false;
+        int dropped = 0;
+        long long pixels = 0; // cells read by collision checks
+};
+#endif
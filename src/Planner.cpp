@@ -0,0 +1,584 @@
+#include "Planner.h"
+
+#include "Affinity.h"
+#include "Counters.h"
+#include "Grow.h"
+#include "Partition.h"
+
+using namespace rrt_utils;
+
+Planner::Planner(const Backend *_backend, PlannerConfig _config, unsigned seed)
+    : backend(_backend), config_(_config), generator(seed) {
+    config_.batch_size = max(1, config_.batch_size);
+    config_.coarse_factor = max(1, config_.coarse_factor);
+    config_.lazy = config_.lazy && config_.regions <= 1;
+    nodes.reserve(config_.max_node + config_.batch_size + 1);
+    path_.reserve(config_.max_node + config_.batch_size + 1);
+    coarse_path.reserve(config_.max_node + config_.batch_size + 3);
+    batch_starts.resize(config_.batch_size);
+    batch_ends.resize(config_.batch_size);
+    batch_parents.resize(config_.batch_size);
+    batch_blocked.resize(config_.batch_size);
+    if (config_.lazy) {
+        edge_valid.reserve(config_.max_node + config_.batch_size + 1);
+        check_starts.resize(config_.max_node + config_.batch_size + 1);
+        check_ends.resize(config_.max_node + config_.batch_size + 1);
+        check_nodes.resize(config_.max_node + config_.batch_size + 1);
+        check_blocked.resize(config_.max_node + config_.batch_size + 1);
+    }
+}
+
+// sampling attempts between two deadline checks inside one iteration
+static const int kStopCheckInterval = 64;
+// nodes each stage of coarse-to-fine planning may grow before giving up on it, and
+// samples it may draw per node of that budget (a maze rejects most of them)
+static const int kMinStageNodes = 2000;
+static const int kStageSamplesPerNode = 50;
+
+// shortest random step for a longest one of step_size
+static float min_step_for(float step_size) { return max(15.0f, step_size / 5); }
+
+// node budget of the coarse and of the corridor stage
+static int stage_budget(const PlannerConfig &config) {
+    const int factor = config.coarse_factor;
+    return min(config.max_node, max(kMinStageNodes, config.max_node / (factor * factor)));
+}
+
+// cells a collision check of the segment a-b reads
+static int segment_pixels(const Position &a, const Position &b) {
+    return static_cast<int>(distance(a, b)) + 1;
+}
+
+// Planner's side of the growth kernels in Grow.h: nearest search and collision checks go
+// through the backend, samples through the corridor, and stop() applies the deadline and
+// the sample budget.
+struct Planner::GrowSpace {
+        typedef Position Point;
+        Planner &planner;
+        const GridMap &map;
+        float std;
+        uniform_real_distribution<double> &steps;
+
+        int nearest(const Position &pos) {
+            return planner.backend->nearest(planner.nodes.pos.data(), planner.nodes.size(), pos);
+        }
+        const Position &node(int idx) const { return planner.nodes.pos[idx]; }
+        double distance(const Position &a, const Position &b) const {
+            return rrt_utils::distance(a, b);
+        }
+        // a lazy tree checks the goal edge with the rest of the path in validate_path()
+        bool goal_free(const Position &from, const Position &goal) {
+            if (planner.config_.lazy) return true;
+            planner.pixels += segment_pixels(from, goal);
+            return !planner.backend->intersection(map, from, goal);
+        }
+        bool sample(const Position &target, Position &out) {
+            out = planner.sample(target, std);
+            planner.pixels++;
+            return map[(int)out.y][(int)out.x];
+        }
+        double step() { return steps(planner.generator); }
+        bool edge_free(const Position &start, const Position &end) {
+            return planner.edge_free(start, end, planner.pixels);
+        }
+        int add(const Position &pos, int parent) {
+            return planner.add_node(pos, parent, !planner.config_.lazy);
+        }
+        // a map with little free space can keep the sampling busy for a long time
+        bool stop(int attempt) {
+            if (attempt % kStopCheckInterval == kStopCheckInterval - 1 && planner.should_stop()) {
+                return true;
+            }
+            return planner.samples_left-- <= 0;
+        }
+};
+
+int Planner::add_node(const Position &pos, int parent, bool checked) {
+    if (config_.lazy) edge_valid.push_back(checked);
+    return nodes.add(pos, parent);
+}
+
+Planner::~Planner() {}
+
+void Planner::set_map(const Mat &img) {
+    source = img.clone();
+    index_valid = false;
+    goal_idx = -1;
+    grid = GridMap(img.cols, img.rows, 1);
+    backend->inflate_map(img, grid, config_.radius);
+    replicate_map(grid);
+    if (config_.coarse_factor > 1) {
+        coarse = downsample_map(grid, config_.coarse_factor);
+        corridor = GridMap(coarse.width, coarse.height, 0);
+        coarse_queue.resize(coarse.cells.size());
+        coarse_parent.resize(coarse.cells.size());
+        coarse_path.reserve(max(coarse_path.capacity(), coarse.cells.size() + 2));
+    }
+}
+
+bool Planner::in_corridor(const Position &pos) const {
+    int x = static_cast<int>(pos.x) / config_.coarse_factor;
+    int y = static_cast<int>(pos.y) / config_.coarse_factor;
+    return corridor.inside(x, y) && corridor[y][x];
+}
+
+Position Planner::sample(const Position &target, float std) {
+    if (!use_corridor) {
+        return random_position(target, std, active_map->width, active_map->height, generator);
+    }
+    // a point on a random segment of the coarse path, spread over the corridor width
+    uniform_int_distribution<int> pick_segment(0, (int)coarse_path.size() - 2);
+    uniform_real_distribution<float> along(0, 1);
+    normal_distribution<float> spread(0, corridor_radius * config_.coarse_factor / 2.0f);
+    int seg = pick_segment(generator);
+    Position base = coarse_path[seg] + (coarse_path[seg + 1] - coarse_path[seg]) * along(generator);
+    for (int tries = 0; tries < 16; tries++) {
+        Position pos = base + Position(spread(generator), spread(generator));
+        if (grid.inside(pos.x, pos.y) && in_corridor(pos)) return pos;
+    }
+    return base;
+}
+
+// Lazy mode's cheap check of a new edge: its end and its midpoint. A step can only jump
+// an inflated wall at least half a step thick if the wall covers the middle of the step.
+bool Planner::probe(const Position &start, const Position &end, long long &tested) const {
+    Position mid = (start + end) * 0.5f;
+    tested += 2;
+    return (*active_map)[(int)end.y][(int)end.x] && (*active_map)[(int)mid.y][(int)mid.x];
+}
+
+// One step of step_size from start towards target; false when target is closer than
+// that, the step leaves the corridor, or the edge is blocked (in lazy mode: its end).
+// Cells read are added to tested.
+bool Planner::steer(const Position &start, const Position &target, double step_size,
+                    Position &out, long long &tested) const {
+    Position pos_diff = target - start;
+    double dist = distance(start, target);
+    if (dist < step_size) return false;
+    out = start + pos_diff * (step_size / dist);
+    return edge_free(start, out, tested);
+}
+
+// The edge of one steered step: inside the corridor, then the lazy probe or a full check.
+bool Planner::edge_free(const Position &start, const Position &end, long long &tested) const {
+    // leaving the corridor is rejected before paying for a full-resolution check
+    if (use_corridor && !in_corridor(end)) return false;
+    if (config_.lazy) return probe(start, end, tested);
+    tested += segment_pixels(start, end);
+    return !backend->intersection(*active_map, start, end);
+}
+
+// Sample batch_size free points, steer towards each from its nearest node and check all
+// resulting edges with one check_segments() call. Returns the last node added or -1.
+int Planner::extend_batch(const Position &target, float std,
+                          uniform_real_distribution<double> &distribution) {
+    const GridMap &map = *active_map;
+    const int batch = config_.batch_size;
+    int new_idx = -1;
+    for (int attempt = 0; attempt < config_.max_iter && new_idx < 0; attempt += batch) {
+        if (attempt > 0 && should_stop()) break;
+        if (samples_left <= 0) break;
+        samples_left -= batch;
+        int count = 0;
+        for (int tries = 0; tries < batch * 4 && count < batch; tries++) {
+            Position rand_pos = sample(target, std);
+            pixels++;
+            if (!map[(int)rand_pos.y][(int)rand_pos.x]) continue;
+            int near_idx = backend->nearest(nodes.pos.data(), nodes.size(), rand_pos);
+            Position start = nodes.pos[near_idx];
+            double dist = distance(start, rand_pos);
+            double step_size = distribution(generator);
+            if (dist < step_size) continue;
+            Position end = start + (rand_pos - start) * (step_size / dist);
+            if (use_corridor && !in_corridor(end)) continue;
+            batch_starts[count] = start;
+            batch_ends[count] = end;
+            batch_parents[count] = near_idx;
+            count++;
+        }
+        for (int i = 0; i < count; i++) {
+            if (config_.lazy) {
+                batch_blocked[i] = !probe(batch_starts[i], batch_ends[i], pixels);
+            } else {
+                pixels += segment_pixels(batch_starts[i], batch_ends[i]);
+            }
+        }
+        if (!config_.lazy) {
+            backend->check_segments(map, batch_starts.data(), batch_ends.data(), count,
+                                    batch_blocked.data());
+        }
+        for (int i = 0; i < count; i++) {
+            if (!batch_blocked[i]) {
+                new_idx = add_node(batch_ends[i], batch_parents[i], !config_.lazy);
+            }
+        }
+    }
+    return new_idx;
+}
+
+bool Planner::plan(Position start, Position goal) {
+    cancelled.store(false, std::memory_order_relaxed);
+    return run(start, goal);
+}
+
+void Planner::arm_deadline() {
+    timed_out_.store(false, std::memory_order_relaxed);
+    has_deadline = config_.deadline_ms > 0;
+    if (has_deadline) {
+        deadline = std::chrono::steady_clock::now() +
+                   std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                       std::chrono::duration<float, std::milli>(config_.deadline_ms));
+    }
+}
+
+// Cooperative stop: cancel() or the deadline. The clock is only read when a deadline is
+// set; the first thread to see it pass raises cancelled, so every other loop (region
+// threads included) stops at its next check.
+bool Planner::should_stop() {
+    if (cancelled.load(std::memory_order_relaxed)) return true;
+    if (!has_deadline || std::chrono::steady_clock::now() < deadline) return false;
+    timed_out_.store(true, std::memory_order_relaxed);
+    cancelled.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+std::future<bool> Planner::plan_async(Position start, Position goal) {
+    // reset before launching so a cancel() issued right after this call is not lost
+    cancelled.store(false, std::memory_order_relaxed);
+    return std::async(std::launch::async, [this, start, goal] { return run(start, goal); });
+}
+
+// One iteration of grow(): connect to target when it is close and visible, otherwise add
+// a node towards a random sample (or a batch of them). Returns the iterations it counts for.
+int Planner::extend(const GridMap &map, Position target, float std,
+                    uniform_real_distribution<double> &distribution, bool &reached) {
+    GrowSpace space = {*this, map, std, distribution};
+    int counted = 1;
+    int new_idx = rrt_grow::connect(space, target, 1.5 * distribution.b());
+    if (new_idx >= 0) {
+        // a lazy tree only counts once the whole path checks out
+        reached = !config_.lazy || validate_path(new_idx);
+        if (!reached) new_idx = -1;
+    } else if (config_.batch_size > 1) {
+        int before = nodes.size();
+        new_idx = extend_batch(target, std, distribution);
+        counted += max(0, nodes.size() - before - 1);
+    } else {
+        new_idx = rrt_grow::extend(space, target, config_.max_iter);
+    }
+    n_count += counted;
+    if (config_.verbose > 1 && new_idx >= 0) {
+        Position new_pos = nodes.pos[new_idx];
+        float dist = distance(new_pos, target);
+        printf("%4dth node:  pos = [%.1f, %.1f], dist = %4.1f cm    \r", n_count, new_pos.x,
+               new_pos.y, dist);
+    }
+    return counted;
+}
+
+// Grow one tree on map from start until it connects to target, max_nodes were grown or
+// max_samples were drawn. Node count adds up in n_count, so a coarse and a fine stage
+// report their total. Steps are drawn from [min_step, step_size] in cells of map.
+// keep_tree continues from the current tree instead of a fresh root.
+bool Planner::grow(const GridMap &map, Position start, Position target, float step_size,
+                   float min_step, float std, int max_nodes, long long max_samples,
+                   bool keep_tree) {
+    active_map = &map;
+    samples_left = max_samples;
+    if (!keep_tree) {
+        nodes.clear();
+        edge_valid.clear();
+        add_node(start, -1, true);
+    }
+    bool reached = false;
+    int grown = 0;
+    uniform_real_distribution<double> distribution(min_step, step_size);
+    for (int i = 0; i < config_.max_iter; i++) {
+        if (should_stop()) break;
+        grown += extend(map, target, std, distribution, reached);
+        if (grown >= max_nodes || reached || samples_left <= 0) {
+            break;
+        }
+    }
+    if (config_.verbose > 1) printf("\n");
+    return reached;
+}
+
+void Planner::begin(Position start, Position goal) {
+    path_.clear();
+    found = false;
+    n_count = 0;
+    last_start = start;
+    last_goal = goal;
+    index_valid = false;
+    goal_idx = -1;
+    active_map = &grid;
+    pixels = 0;
+    cancelled.store(false, std::memory_order_relaxed);
+    arm_deadline();
+    nodes.clear();
+    edge_valid.clear();
+    add_node(start, -1, true);
+    samples_left = LLONG_MAX;
+    step_distribution =
+        uniform_real_distribution<double>(min_step_for(config_.step_size), config_.step_size);
+}
+
+bool Planner::step() {
+    if (!found) {
+        extend(grid, last_goal, config_.std, step_distribution, found);
+        if (found) goal_idx = nodes.size() - 1;
+    }
+    return found;
+}
+
+bool Planner::end() {
+    if (config_.verbose > 1) printf("\n");
+    finish(last_goal);
+    return found;
+}
+
+int Planner::graft(const Position *points, int count, float max_dist) {
+    int added = 0;
+    for (int i = 0; i < count; i++) {
+        if (!grid.inside(points[i].x, points[i].y)) continue;
+        int near_idx = backend->nearest(nodes.pos.data(), nodes.size(), points[i]);
+        float dist = distance(nodes.pos[near_idx], points[i]);
+        if (dist < 1 || dist > max_dist) continue;
+        pixels += segment_pixels(nodes.pos[near_idx], points[i]);
+        if (!backend->intersection(grid, nodes.pos[near_idx], points[i])) {
+            add_node(points[i], near_idx, true);
+            added++;
+        }
+    }
+    index_valid = false;
+    return added;
+}
+
+// Shortest 4-connected route through the free coarse cells, by breadth-first search, as
+// full-resolution cell centres in coarse_path. Max-pooling keeps connected pixels
+// connected, so when there is no route the full map has no path either.
+bool Planner::coarse_route(Position start, Position target) {
+    int sx = static_cast<int>(start.x), sy = static_cast<int>(start.y);
+    int tx = static_cast<int>(target.x), ty = static_cast<int>(target.y);
+    if (!coarse.inside(sx, sy) || !coarse.inside(tx, ty) || !coarse[sy][sx] || !coarse[ty][tx]) {
+        return false;
+    }
+    const int width = coarse.width;
+    const int source = sy * width + sx, goal = ty * width + tx;
+    fill(coarse_parent.begin(), coarse_parent.end(), -1);
+    int head = 0, tail = 0;
+    coarse_queue[tail++] = source;
+    coarse_parent[source] = source;
+    while (head < tail && coarse_parent[goal] < 0) {
+        int cell = coarse_queue[head++];
+        int x = cell % width, y = cell / width;
+        const int nx[4] = {x - 1, x + 1, x, x}, ny[4] = {y, y, y - 1, y + 1};
+        for (int k = 0; k < 4; k++) {
+            if (!coarse.inside(nx[k], ny[k])) continue;
+            int next = ny[k] * width + nx[k];
+            if (coarse_parent[next] >= 0 || !coarse.cells[next]) continue;
+            coarse_parent[next] = cell;
+            coarse_queue[tail++] = next;
+        }
+    }
+    if (coarse_parent[goal] < 0) return false;
+    const float factor = config_.coarse_factor;
+    coarse_path.clear();
+    coarse_path.push_back(target * factor);
+    for (int cell = coarse_parent[goal]; cell != source; cell = coarse_parent[cell]) {
+        coarse_path.push_back(Position(cell % width + 0.5f, cell / width + 0.5f) * factor);
+    }
+    coarse_path.push_back(start * factor);
+    reverse(coarse_path.begin(), coarse_path.end());
+    return true;
+}
+
+// Plan on the downsampled map and turn the result into the corridor for the fine stage.
+// Steps and sampling spread are scaled to coarse cells, so the coarse tree takes as many
+// steps through the map as a full-resolution one would. When that search runs out of its
+// budget (mazes) the grid route is the corridor instead.
+bool Planner::plan_coarse(Position start, Position target) {
+    const int factor = config_.coarse_factor;
+    const float scale = 1.0f / factor;
+    Position coarse_start = start * scale, coarse_goal = target * scale;
+    if (!coarse_route(coarse_start, coarse_goal)) {
+        if (config_.verbose > 0) printf("Coarse map has no path, skipping the coarse stage.\n");
+        return false;
+    }
+    const int budget = stage_budget(config_);
+    if (grow(coarse, coarse_start, coarse_goal, config_.step_size * scale,
+             min_step_for(config_.step_size) * scale, config_.std * scale, budget,
+             (long long)budget * kStageSamplesPerNode)) {
+        coarse_path.clear();
+        coarse_path.push_back(target);
+        for (int idx = nodes.size() - 1; idx >= 0; idx = nodes.parent[idx]) {
+            coarse_path.push_back(nodes.pos[idx] * factor);
+        }
+        coarse_path.push_back(start);
+        reverse(coarse_path.begin(), coarse_path.end());
+    } else if (config_.verbose > 0) {
+        printf("Coarse search failed, following the grid route.\n");
+    }
+
+    // mark every coarse cell within corridor_radius of the path
+    corridor_radius = max(2, static_cast<int>(config_.step_size / 4));
+    fill(corridor.cells.begin(), corridor.cells.end(), 0);
+    for (size_t i = 0; i + 1 < coarse_path.size(); i++) {
+        Position a = coarse_path[i] * scale, b = coarse_path[i + 1] * scale;
+        int steps = max(1, static_cast<int>(distance(a, b)));
+        for (int s = 0; s <= steps; s++) {
+            Position p = a + (b - a) * (static_cast<float>(s) / steps);
+            for (int dy = -corridor_radius; dy <= corridor_radius; dy++) {
+                for (int dx = -corridor_radius; dx <= corridor_radius; dx++) {
+                    int x = static_cast<int>(p.x) + dx, y = static_cast<int>(p.y) + dy;
+                    if (dx * dx + dy * dy <= corridor_radius * corridor_radius &&
+                        corridor.inside(x, y)) {
+                        corridor[y][x] = 1;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool Planner::run(Position start, Position target) {
+    CounterScope scope(kPhasePlan);
+    path_.clear();
+    found = false;
+    goal_idx = -1;
+    n_count = 0;
+    pixels = 0;
+    last_start = start;
+    last_goal = target;
+    index_valid = false;
+    arm_deadline();
+    if (config_.regions > 1) {
+        found = grow_partitioned(start, target);
+        goal_idx = found ? nodes.size() - 1 : -1;
+        finish(target);
+        return found;
+    }
+    const float min_step = min_step_for(config_.step_size);
+    if (config_.coarse_factor > 1 && plan_coarse(start, target)) {
+        // the coarse path is only a hint (max-pooling opens thin walls), so the corridor
+        // gets the normal steps and a small budget before the full map is tried
+        const int budget = stage_budget(config_);
+        use_corridor = true;
+        found = grow(grid, start, target, config_.step_size, min_step, config_.std, budget,
+                     (long long)budget * kStageSamplesPerNode);
+        use_corridor = false;
+        if (!found && config_.verbose > 0) {
+            printf("Corridor search failed, falling back to the full map.\n");
+        }
+    }
+    if (!found && !cancelled.load(std::memory_order_relaxed)) {
+        found = grow(grid, start, target, config_.step_size, min_step, config_.std,
+                     config_.max_node, LLONG_MAX);
+    }
+    goal_idx = found ? nodes.size() - 1 : -1;
+    finish(target);
+    return found;
+}
+
+// Lazy mode: check all not yet checked edges between goal and the root with a single
+// check_segments() call. Blocked edges are cut off together with their subtrees (the
+// goal among them); returns true when the whole path is free.
+bool Planner::validate_path(int goal) {
+    CounterScope scope(kPhaseValidate);
+    int count = 0;
+    for (int idx = goal; nodes.parent[idx] >= 0; idx = nodes.parent[idx]) {
+        if (edge_valid[idx]) continue;
+        if (count == (int)check_nodes.size()) {
+            check_nodes.resize(2 * count);
+            check_starts.resize(2 * count);
+            check_ends.resize(2 * count);
+            check_blocked.resize(2 * count);
+        }
+        check_nodes[count] = idx;
+        check_starts[count] = nodes.pos[nodes.parent[idx]];
+        check_ends[count] = nodes.pos[idx];
+        pixels += segment_pixels(check_starts[count], check_ends[count]);
+        count++;
+    }
+    backend->check_segments(*active_map, check_starts.data(), check_ends.data(), count,
+                            check_blocked.data());
+    bool clear = true;
+    for (int i = 0; i < count; i++) {
+        if (check_blocked[i]) {
+            clear = false;
+        } else {
+            edge_valid[check_nodes[i]] = 1;
+        }
+    }
+    if (clear) return true;
+
+    build_children();
+    node_state.assign(nodes.size(), kAttached);
+    for (int i = 0; i < count; i++) {
+        if (check_blocked[i] && node_state[check_nodes[i]] != kDropped) {
+            mark_subtree(check_nodes[i], kDropped);
+        }
+    }
+    compact_tree();
+    return false;
+}
+
+void Planner::finish(Position target) {
+    if (found) {
+        if (config_.verbose > 0) {
+            printf("Finish RRT construction in with %d nodes.\n", n_count);
+        }
+        for (int idx = goal_idx; idx >= 0; idx = nodes.parent[idx]) {
+            path_.push_back(nodes.pos[idx]);
+        }
+        reverse(path_.begin(), path_.end());
+    } else if (timed_out() && nodes.size() > 0) {
+        // anytime result: the branch that got closest to the goal, in full-resolution
+        // pixels even if the deadline hit the coarse stage
+        const float scale = active_map == &coarse ? config_.coarse_factor : 1;
+        int closest = closest_reached(target);
+        printf("Failed! Deadline reached with %d nodes, closest node %.1f from the goal.\n",
+               n_count, distance(nodes.pos[closest] * scale, target));
+        for (int idx = closest; idx >= 0; idx = nodes.parent[idx]) {
+            path_.push_back(nodes.pos[idx] * scale);
+        }
+        reverse(path_.begin(), path_.end());
+    } else {
+        printf(
+            "Failed! RRT construction terminated with %d "
+            "nodes.\n",
+            n_count);
+        path_.push_back(target);
+    }
+}
+
+// Node closest to target whose path to the root is known to be free. In lazy mode edges
+// are only checked once they are on a candidate path: the closest branch gets one batched
+// check, and if that cuts it, the closest branch without unchecked edges is taken
+// (node_state is 1 for a checked path, 2 otherwise, 0 while unknown).
+int Planner::closest_reached(const Position &target) {
+    int closest = backend->nearest(nodes.pos.data(), nodes.size(), target);
+    if (!config_.lazy || validate_path(closest)) return closest;
+    node_state.assign(nodes.size(), 0);
+    node_state[0] = 1;
+    closest = 0;
+    float min_dist = distance(nodes.pos[0], target);
+    for (int i = 1; i < nodes.size(); i++) {
+        subtree_stack.clear();
+        int idx = i;
+        for (; node_state[idx] == 0; idx = nodes.parent[idx]) subtree_stack.push_back(idx);
+        uint8_t state = node_state[idx];
+        for (int k = (int)subtree_stack.size() - 1; k >= 0; k--) {
+            if (!edge_valid[subtree_stack[k]]) state = 2;
+            node_state[subtree_stack[k]] = state;
+        }
+        float dist = distance(nodes.pos[i], target);
+        if (node_state[i] == 1 && dist < min_dist) {
+            min_dist = dist;
+            closest = i;
+        }
+    }
+    return closest;
+}
@@ -0,0 +1,201 @@
+#ifndef __RRT_PLANNER__
+#define __RRT_PLANNER__
+
+#include <chrono>
+#include <climits>
+#include <future>
+#include <memory>
+
+#include "Util.h"
+
+struct PlannerConfig {
+        float step_size = 50;
+        int max_iter = 250000;
+        int max_node = 100000;
+        float std = 1000;
+        float radius = 15;
+        int verbose = 0;
+        // candidate extensions collision-checked together per iteration, 1 = classic RRT
+        int batch_size = 1;
+        // > 1: plan on the map downsampled by this factor first, then refine at full
+        // resolution inside a corridor around that coarse path
+        int coarse_factor = 1;
+        // > 1: domain decomposition, the map is split into this many strips, each grown by
+        // its own thread (strips are kept at least two steps wide); ignores coarse_factor
+        int regions = 1;
+        // Lazy-RRT: new edges only get their end point checked; the edges of a candidate
+        // start-goal path are checked together once it exists, blocked ones are cut with
+        // their subtrees and growth goes on. Not used with regions > 1.
+        bool lazy = false;
+        // > 0: a query stops after this many milliseconds of planning; path() then holds
+        // the branch that got closest to the goal (see timed_out())
+        float deadline_ms = 0;
+};
+
+struct RegionState;
+
+// What an obstacle update did to the last tree.
+struct ReplanStats {
+        int cells_changed = 0;   // inflated cells whose value flipped
+        int edges_checked = 0;   // edges found through the spatial index
+        int edges_invalid = 0;   // of those, now crossing an obstacle
+        int reattached = 0;      // orphaned subtrees hooked onto the remaining tree
+        int dropped = 0;         // nodes removed with subtrees that could not be reattached
+
+        ReplanStats &operator+=(const ReplanStats &other) {
+            cells_changed += other.cells_changed;
+            edges_checked += other.edges_checked;
+            edges_invalid += other.edges_invalid;
+            reattached += other.reattached;
+            dropped += other.dropped;
+            return *this;
+        }
+};
+
+// Reusable RRT planner. Owns the inflated map, the tree storage and the RNG, so one
+// instance can answer any number of queries. After the first plan() has sized the
+// buffers, later queries do not touch the heap, except in region mode, which starts its
+// threads per query.
+class Planner {
+    public:
+        Planner(const Backend *_backend, PlannerConfig _config = PlannerConfig(),
+                unsigned seed = random_device{}());
+        ~Planner();
+
+        // inflate the obstacles of a grayscale image with config().radius
+        void set_map(const Mat &img);
+        void set_backend(const Backend *_backend) { backend = _backend; }
+
+        // grow a tree from start until it reaches goal; true on success
+        bool plan(Position start, Position goal);
+        // plan() on a worker thread, stop it early with cancel()
+        std::future<bool> plan_async(Position start, Position goal);
+        void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+
+        // Incremental updates of the map the last plan() ran on. Only the edited region is
+        // re-inflated and only tree edges crossing it are re-checked; subtrees behind a now
+        // blocked edge are reattached or dropped. replan() then reuses what is left.
+        // value: 0 paints the rectangles as obstacles, 255 clears them
+        ReplanStats apply_obstacles(const vector<Rect> &rects, uint8_t value = 0);
+        // img: the whole grayscale map after the change
+        ReplanStats apply_diff(const Mat &img);
+        bool replan();
+
+        // Step-wise growth on the full map, for drivers that interleave their own work with
+        // the search (RRT_mpi exchanges nodes between ranks). begin() roots a new tree at
+        // start, step() is one iteration of plan() and returns true once goal is connected,
+        // end() builds path() the way plan() does.
+        void begin(Position start, Position goal);
+        bool step();
+        bool end();
+        // Hook points grown elsewhere onto the nearest node of this tree when that edge is
+        // free and at most max_dist long; returns the number of nodes added.
+        int graft(const Position *points, int count, float max_dist);
+
+        const GridMap &map() const { return grid; }
+        const TreeStore &tree() const { return nodes; }
+        // start -> goal on success; after a missed deadline start -> the node closest to
+        // the goal, only the goal otherwise
+        const vector<Position> &path() const { return path_; }
+        const Backend *get_backend() const { return backend; }
+        const PlannerConfig &config() const { return config_; }
+        bool success() const { return found; }
+        // the last query ran into config().deadline_ms
+        bool timed_out() const { return timed_out_.load(std::memory_order_relaxed); }
+        int node_count() const { return n_count; }
+        // map cells read by collision checks of the last query (a segment reads one cell
+        // per pixel of length, a point check one)
+        long long pixels_tested() const { return pixels; }
+
+    private:
+        bool run(Position start, Position goal);
+        void arm_deadline();
+        bool should_stop();
+        int closest_reached(const Position &target);
+        bool grow(const GridMap &map, Position start, Position target, float step_size,
+                  float min_step, float std, int max_nodes, long long max_samples,
+                  bool keep_tree = false);
+        int extend(const GridMap &map, Position target, float std,
+                   uniform_real_distribution<double> &distribution, bool &reached);
+        void finish(Position target);
+        ReplanStats update_regions(const vector<Rect> &rects);
+        void build_edge_index();
+        void repair_tree(vector<int> &invalid, ReplanStats &stats);
+        void build_children();
+        int mark_subtree(int root, uint8_t value);
+        void compact_tree();
+        void sort_parent_first();
+        bool validate_path(int goal);
+        bool plan_coarse(Position start, Position target);
+        bool coarse_route(Position start, Position target);
+        Position sample(const Position &target, float std);
+        bool in_corridor(const Position &pos) const;
+        int add_node(const Position &pos, int parent, bool checked);
+        bool probe(const Position &start, const Position &end, long long &tested) const;
+        bool steer(const Position &start, const Position &target, double step_size,
+                   Position &out, long long &tested) const;
+        bool edge_free(const Position &start, const Position &end, long long &tested) const;
+        struct GrowSpace; // what the Grow.h kernels see of this planner
+        bool grow_partitioned(Position start, Position target);
+        void region_worker(int r, Position target, std::atomic<bool> &stop,
+                           std::atomic<int> &winner, std::atomic<int> &node_total,
+                           std::atomic<int> &retired);
+        int extend_batch(const Position &target, float std,
+                         uniform_real_distribution<double> &distribution);
+
+        const Backend *backend;
+        PlannerConfig config_;
+        GridMap grid;
+        const GridMap *active_map = &grid; // map the current grow() works on
+        // coarse-to-fine mode: grid max-pooled by coarse_factor, the coarse cells close
+        // to the coarse path, and that path in full-resolution pixels
+        GridMap coarse;
+        GridMap corridor;
+        vector<int> coarse_queue;    // breadth-first search scratch, one entry per coarse cell
+        vector<int> coarse_parent;
+        vector<Position> coarse_path;
+        int corridor_radius = 0;
+        bool use_corridor = false;
+        // incremental replanning: source image, last query, and edges bucketed by cell
+        Mat source;
+        Position last_start;
+        Position last_goal;
+        int goal_idx = -1;
+        int bucket_cols = 0;
+        vector<vector<int>> edge_buckets;
+        bool index_valid = false;
+        // tree surgery scratch: children in CSR form, per-node state and index remap
+        enum : uint8_t { kAttached, kOrphaned, kDropped };
+        vector<int> child_start;
+        vector<int> child_list;
+        vector<uint8_t> node_state;
+        vector<int> remap;
+        vector<int> subtree_stack;
+        // lazy mode: 1 once the edge to the parent was checked, plus the path check buffers
+        vector<uint8_t> edge_valid;
+        vector<Position> check_starts;
+        vector<Position> check_ends;
+        vector<int> check_nodes;
+        vector<uint8_t> check_blocked;
+        TreeStore nodes;
+        vector<Position> path_;
+        // scratch for extend_batch(), sized once in the constructor
+        vector<Position> batch_starts;
+        vector<Position> batch_ends;
+        vector<int> batch_parents;
+        vector<uint8_t> batch_blocked;
+        uniform_real_distribution<double> step_distribution; // for step()
+        vector<std::unique_ptr<RegionState>> regions_;        // domain decomposition
+        TreeStore merged;                                     // sort_parent_first() scratch
+        int split_axis = 0;                                   // 0 strips along x, 1 along y
+        std::mt19937 generator;
+        std::atomic<bool> cancelled{false};
+        std::atomic<bool> timed_out_{false};
+        bool has_deadline = false;
+        std::chrono::steady_clock::time_point deadline;
+        bool found = false;
+        long long samples_left = 0; // sampling budget of the current grow()
+        int n_count = 0;
+        long long pixels = 0;
+};
+#endif
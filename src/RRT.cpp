@@ -1,286 +1,528 @@
-#include <chrono>
-#include <cstdio>
-#include <cstdlib>
-#include <iostream>
-#include <numeric>
-#include <vector>
-
-#include "Util.h"
-
-using namespace std;
-using namespace chrono;
-using namespace rrt_utils;
-
-typedef duration<float> float_secs;
-
-string _map_names[] = {"res/map.png", "res/maze1.png", "res/maze2.png", "res/maze3.png", "res/maze2_mid.png", "res/maze2_big.png"};
-Position _startposs[] = {Position(1235, 330), Position(10, 445), Position(20, 405),
-                         Position(1265, 65), Position(20, 405)*2.5, Position(20, 405)*4};
-Position _targetposs[] = {Position(390, 665), Position(585, 975), Position(215, 975),
-                          Position(180, 945), Position(215, 975)*2.5, Position(215, 975)*4};
-struct arguments {
-        int testruns = 1;
-        int max_iter = 250000;
-        int max_node = 100000;
-        float std = 1000;
-        float radius = 15;
-        float step_size = 50;
-        string map_name = "res/map.png";
-        Position startpos = Position(1235, 330);
-        Position targetpos = Position(390, 665);
-        int plot = 0;
-        int verbose = 0;
-        int flag = 0;
-};
-
-void usage(const char *progname) {
-    printf("Usage: %s [options]\n", progname);
-    printf("Program Options:\n");
-    printf("  -i  --iter    <INT>   Test iterations(>1)\n");
-    printf("  -m  --map     <INT>   Input map (0, 1, 2, 3)\n");
-    printf("  -r  --radius  <FLOAT> Radius to inflate the obstacles\n");
-    printf("  -l  --steplen <FLOAT> Step length for getting new nodes(>15)\n");
-    printf("  -s  --std     <FLOAT> Std for generate rand node\n");
-    printf("  -p  --plot            Whether to plot the result and save\n");
-    printf("  -v  --verbose <INT>   Whether to print info\n");
-    printf("  -h  --help            This message\n");
-}
-
-arguments process_opt(int argc, char *argv[]) {
-    const char *optstring = "i:m:r:l:s:v::ph";
-    int opt;
-    static struct option long_options[] = {{"map", 1, NULL, 'm'},     {"radius", 1, NULL, 'r'},
-                                           {"steplen", 1, NULL, 'l'}, {"std", 1, NULL, 's'},
-                                           {"plot", 0, NULL, 'p'},    {"verbose", 2, NULL, 'v'},
-                                           {"help", 0, NULL, '?'}};
-    arguments args;
-    while ((opt = getopt_long(argc, argv, optstring, long_options, NULL)) != -1) {
-        switch (opt) {
-            case 'i': {
-                args.testruns = atoi(optarg);
-                break;
-            }
-            case 'm': {
-                int i = atoi(optarg);
-                if (i < 5) {
-                    args.map_name = _map_names[i];
-                    args.startpos = _startposs[i];
-                    args.targetpos = _targetposs[i];
-                }
-                break;
-            }
-            case 'r': {
-                args.radius = atof(optarg);
-                break;
-            }
-            case 'l': {
-                args.step_size = atof(optarg);
-                break;
-            }
-            case 's': {
-                args.std = atof(optarg);
-                break;
-            }
-            case 'p': {
-                args.plot = 1;
-                break;
-            }
-            case 'v': {
-                if (optarg) {
-                    args.verbose = atoi(optarg);
-                } else {
-                    args.verbose = 1;
-                }
-                break;
-            }
-            case 'h':
-            default:
-                usage(argv[0]);
-                args.flag = -1;
-                return args;
-        }
-    }
-    if (args.testruns > 1) {
-        args.verbose = 0;
-        args.plot = 0;
-    }
-    return args;
-}
-
-Tree *RRT(arguments args, vector<vector<uint8_t>> &map, Position start, Position target,
-          float step_size, int max_iter, int max_node, float std, std::mt19937 &generator) {
-    TreeNode *root = new TreeNode(start);
-    TreeNode *end = new TreeNode(target);
-    Tree *tree = new Tree(root, end);
-    vector<TreeNode*> vec;
-    vec.push_back(root);
-    int i, n_count = 0;
-    for (i = 0; i < max_iter; i++) {
-        TreeNode *near_node = nearest(vec, end);
-        TreeNode *new_node = NULL;
-        float dist = distance(near_node->pos, end->pos);
-        if (dist < 1.5 * step_size && !intersection(map, near_node->pos, target)) {
-            end->parent = near_node;
-            near_node->child.push_back(end);
-            tree->success = true;
-            new_node = end;
-        } else {
-            for (int attempt = 0; attempt < max_iter; ++attempt) {
-                mt19937 thread_generator(generator());
-                TreeNode *rand_node = random_position(end->pos, std, thread_generator);
-                if (map[rand_node->pos.y][rand_node->pos.x]) {
-                    near_node = nearest(vec, rand_node);
-                    uniform_real_distribution<double> distribution(max(15.0f, step_size/5), step_size);
-                    double rng_step_size = distribution(thread_generator);
-                    new_node = get_new_node(map, near_node, rand_node, rng_step_size);
-                    if (new_node) {
-                        vec.push_back(new_node);
-                        break;
-                    }
-                }
-            }
-        }
-        n_count++;
-        if (args.verbose > 1) {
-            dist = distance(new_node->pos, end->pos);
-            printf("%4dth node:  pos = [%.1f, %.1f], dist = %4.1f cm    \r", n_count,
-                   new_node->pos.x, new_node->pos.y, dist);
-        }
-        if (n_count >= max_node || tree->success) {
-            break;
-        }
-    }
-    if (args.verbose > 1) printf("\n");
-    if (tree->success) {
-        if (args.verbose > 0) {
-            printf("Finish RRT construction in with %d nodes.\n", n_count);
-        }
-    } else {
-        printf(
-            "Failed! RRT construction terminated with %d "
-            "nodes.\n",
-            n_count);
-    }
-    return tree;
-}
-
-result path_search(arguments args, vector<vector<uint8_t>> &map, Position startpos, Position endpos,
-                   float step_size = 30, int max_iter = 10000, int max_node = 500,
-                   float std = 500) {
-    std::random_device rd;
-    static thread_local std::mt19937 rng(rd());
-    auto start = system_clock::now();
-    Tree *tree = RRT(args, map, startpos, endpos, step_size, max_iter, max_node, std, rng);
-    auto end = system_clock::now();
-    vector<Position> path;
-    if (tree->success) {
-        TreeNode *current = tree->end;
-        while (current) {
-            path.insert(path.begin(), current->pos);
-            current = current->parent;
-        }
-    } else {
-        path.insert(path.begin(), tree->end->pos);
-    }
-    return result{tree, path, duration_cast<float_secs>(end - start).count()};
-}
-
-int main(int argc, char **argv) {
-    arguments args = process_opt(argc, argv);
-    if (args.flag) return 1;
-    if (args.verbose > 1) {
-        printf("startpos: [%.0f, %.0f], targetpos: [%.0f, %.0f]\n", args.startpos.x,
-               args.startpos.y, args.targetpos.x, args.targetpos.y);
-    }
-
-    /* read img as bool map; */
-    Mat img;
-    img = imread(args.map_name, IMREAD_GRAYSCALE);
-    vector<vector<uint8_t>> map(img.rows, vector<uint8_t>(img.cols, 1));
-    vector<float> times;
-    
-    auto start = system_clock::now();
-    inflate_map(img, map, args.radius);
-    auto mid = system_clock::now();
-
-    if (args.plot) { // plot how the map is read (with obstacles inflated)
-        Mat temp_mat(img.rows, img.cols, CV_8U);
-        for (int i = 0; i < img.rows; ++i) {
-            for (int j = 0; j < img.cols; ++j) {
-                temp_mat.at<uint8_t>(i, j) = map[i][j] ? 255 : 0;
-            }
-        }
-        Point start_point = Point(args.startpos.x, args.startpos.y);
-        Point target_point = Point(args.targetpos.x, args.targetpos.y);
-        circle(temp_mat, start_point, 6, Scalar(0, 0, 0), 10, LINE_AA);
-        circle(temp_mat, target_point, 6, Scalar(0, 0, 0), 10, LINE_AA);
-        imwrite("res/read_map.png", temp_mat);
-    }
-
-    for (int runs = 0; runs < args.testruns; runs++) {
-        auto [tree, path, time] =
-            path_search(args, map, args.startpos, args.targetpos, args.step_size, args.max_iter,
-                        args.max_node, args.std);
-        float total_time = duration_cast<float_secs>(mid - start).count() + time;
-        times.push_back(total_time);
-
-        if (args.testruns == 1) printf("Time = %.3fs\n", total_time);
-        if (args.verbose > 1) {
-            printf("\nStart position\n");
-            for (size_t i = 0; i < path.size() - 1; i++) {
-                printf("[%4.0f, %4.0f] -> ", path[i].x, path[i].y);
-                if (i % 4 == 0) cout << endl;
-            }
-            if (path.size() % 4 != 2) cout << endl;
-            if (path.size() > 0)
-                printf("[%4.0f, %4.0f]\nTarget position\n", path[path.size() - 1].x,
-                       path[path.size() - 1].y);
-        }
-        if (args.plot) {
-            img = imread(args.map_name, IMREAD_COLOR_BGR);
-            plot(img, tree, args.startpos, args.targetpos, path, "result_omp");
-        }
-    }
-
-    if (args.testruns > 1) {
-        
-        vector<float> original_times(times);
-        vector<float> erased_time;
-        
-        int flag = 1;
-        while (flag) {
-            flag = 0;
-            float mean = rrt_utils::mean(times);
-            float std = rrt_utils::std(times, mean);
-            for (size_t i = 0; i < times.size(); i++) {
-                // 90% confident, 1.64sigma
-                if (times[i] > (mean + 1.64 * std) || times[i] < (mean - 1.64 * std)) {
-                    erased_time.push_back(times[i]);
-                    times.erase(times.begin()+i);
-                    flag = 1;
-                }
-            }
-        }
-
-        int count = 0;
-        for (float time : original_times) {
-            if(find(erased_time.begin(), erased_time.end(), time) != erased_time.end()){
-                printf("Run%3d = %.3f (Outlier)\n", ++count, time);
-            }else{
-                printf("Run%3d = %.3f\n", ++count, time);
-            }
-        }
-
-        sort(times.begin(), times.end());
-        float mean = rrt_utils::mean(times);
-        float std = rrt_utils::std(times, mean);
-        float p25 = find_percentile(times, 25);
-        float median = find_percentile(times, 50);
-        float p75 = find_percentile(times, 75);
-        printf("All Time in seconds, Total valid test runs = %ld.\n", times.size());
-        
-        printf("Avg. = %.3f, Std. = %.3f, P25 = %.3f, Median = %.3f, P75 = %.3f\n", mean, std, p25,
-               median, p75);
-    }
-    return 0;
-}
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+#include "Affinity.h"
+#include "Counters.h"
+#include "Lockstep.h"
+#include "Maps.h"
+#include "Output.h"
+#include "Planner.h"
+#include "Roadmap.h"
+#include "Stats.h"
+
+using namespace std;
+using namespace chrono;
+using namespace rrt_utils;
+
+typedef duration<float> float_secs;
+
+#ifndef RRT_DEFAULT_BACKEND
+#define RRT_DEFAULT_BACKEND "serial"
+#endif
+
+struct arguments {
+        int testruns = 1;
+        int warmup = 0;       // untimed runs before the -i ones
+        string bench_file;    // per-run metrics and their statistics, CSV (or .json)
+        int max_iter = 250000;
+        int max_node = 100000;
+        float std = 1000;
+        float radius = 15;
+        float step_size = 50;
+        string map_name = "res/map.png";
+        Position startpos = Position(1235, 330);
+        Position targetpos = Position(390, 665);
+        const Backend *backend = find_backend(RRT_DEFAULT_BACKEND);
+        int batch_size = 1;
+        int coarse_factor = 1;
+        int regions = 1;
+        bool lazy = false;
+        float deadline_ms = 0; // > 0: bound every query, a late one returns a partial path
+        int prm_samples = 0;  // > 0: answer queries from a roadmap of this many nodes
+        string roadmap_file;  // load the roadmap from here, or build and save it there
+        int lanes = 0;        // 8: answer the -i queries in lockstep, one per SIMD lane
+        ThreadConfig threads;
+        string export_prefix;
+        bool counters = false; // perf_event counters per phase, kernel and thread
+        string counters_file;  // and their CSV (or .json) dump
+        string trace_file;     // Chrome trace-event timeline, written at exit
+        vector<Rect> updates; // obstacles added before a replan
+        string diff_map;      // edited map to replan against
+        int plot = 0;
+        int verbose = 0;
+        int flag = 0;
+};
+
+// pixels along the path
+float path_length(const vector<Position> &path) {
+    float length = 0;
+    for (size_t i = 1; i < path.size(); i++) length += distance(path[i - 1], path[i]);
+    return length;
+}
+
+void usage(const char *progname) {
+    printf("Usage: %s [options]\n", progname);
+    printf("Program Options:\n");
+    printf("  -i  --iter    <INT>   Test iterations(>1)\n");
+    printf("  -w  --warmup  <INT>   Untimed runs before the test iterations\n");
+    printf("  -B  --bench   <PATH>  Time the kernels of every run, save runs and statistics CSV/JSON\n");
+    printf("  -m  --map     <INT>   Input map (0, 1, 2, 3, 4, 5)\n");
+    printf("  -r  --radius  <FLOAT> Radius to inflate the obstacles\n");
+    printf("  -l  --steplen <FLOAT> Step length for getting new nodes(>15)\n");
+    printf("  -s  --std     <FLOAT> Std for generate rand node\n");
+    printf("  -b  --backend <NAME>  Parallel backend (serial, omp, pthread, ws)\n");
+    printf("  -n  --batch   <INT>   Candidate extensions checked together per iteration\n");
+    printf("  -c  --coarse  <INT>   Plan on the map downsampled by this factor first\n");
+    printf("  -R  --regions <INT>   Split the map into strips grown by one thread each\n");
+    printf("  -L  --lazy            Check edges only once they are on a candidate path\n");
+    printf("  -T  --deadline-ms <FLOAT> Stop a query after this many ms, keep its best branch\n");
+    printf("  -P  --prm     <INT>   Answer the queries from a roadmap of this many nodes\n");
+    printf("  -g  --roadmap <PATH>  Load the roadmap from PATH, or build it and save it there\n");
+    printf("  -Q  --lockstep <INT>  Run the -i queries in lockstep on 8 SIMD lanes\n");
+    printf("  -t  --threads <INT>   Worker threads per kernel (default omp 8, pthread 4, ws all)\n");
+    printf("  -a  --affinity <STR>  Pin threads: compact, scatter or a cpu list like 0,2,4-7\n");
+    printf("  -N  --numa            Replicate the inflated map on every NUMA node\n");
+    printf("  -u  --update  <x,y,w,h> Add an obstacle after planning and replan (repeatable)\n");
+    printf("  -D  --diff    <PATH>  Replan against this edited copy of the map\n");
+    printf("  -k  --counters[=PATH] Print hardware counters per phase and thread, save CSV/JSON\n");
+    printf("  -x  --trace   <PATH>  Write a per-thread timeline of phases and kernels (Chrome JSON)\n");
+    printf("  -p  --plot            Whether to plot the result and save\n");
+    printf("  -o  --export  <PATH>  Dump tree and path of every run to <PATH>_<run>.rrt\n");
+    printf("  -v  --verbose <INT>   Whether to print info\n");
+    printf("  -h  --help            This message\n");
+}
+
+arguments process_opt(int argc, char *argv[]) {
+    const char *optstring = "i:w:B:m:r:l:s:b:n:c:R:LT:P:g:Q:t:a:No:u:D:k::x:v::ph";
+    int opt;
+    static struct option long_options[] = {{"iter", 1, NULL, 'i'},    {"warmup", 1, NULL, 'w'},
+                                           {"bench", 1, NULL, 'B'},   {"map", 1, NULL, 'm'},     {"radius", 1, NULL, 'r'},
+                                           {"steplen", 1, NULL, 'l'}, {"std", 1, NULL, 's'},
+                                           {"backend", 1, NULL, 'b'}, {"batch", 1, NULL, 'n'},
+                                           {"coarse", 1, NULL, 'c'},  {"regions", 1, NULL, 'R'},
+                                           {"lazy", 0, NULL, 'L'},    {"deadline-ms", 1, NULL, 'T'},
+                                           {"prm", 1, NULL, 'P'},
+                                           {"roadmap", 1, NULL, 'g'}, {"lockstep", 1, NULL, 'Q'},
+                                           {"threads", 1, NULL, 't'}, {"affinity", 1, NULL, 'a'},
+                                           {"numa", 0, NULL, 'N'},       {"export", 1, NULL, 'o'},
+                                           {"update", 1, NULL, 'u'},  {"diff", 1, NULL, 'D'},
+                                           {"counters", 2, NULL, 'k'}, {"trace", 1, NULL, 'x'},
+                                           {"plot", 0, NULL, 'p'},    {"verbose", 2, NULL, 'v'},
+                                           {"help", 0, NULL, '?'}};
+    arguments args;
+    while ((opt = getopt_long(argc, argv, optstring, long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'i': {
+                args.testruns = atoi(optarg);
+                break;
+            }
+            case 'w': {
+                args.warmup = max(0, atoi(optarg));
+                break;
+            }
+            case 'B': {
+                args.bench_file = optarg;
+                break;
+            }
+            case 'm': {
+                int i = atoi(optarg);
+                if (i >= 0 && i < _map_count) {
+                    args.map_name = _map_names[i];
+                    args.startpos = _startposs[i];
+                    args.targetpos = _targetposs[i];
+                }
+                break;
+            }
+            case 'r': {
+                args.radius = atof(optarg);
+                break;
+            }
+            case 'l': {
+                args.step_size = atof(optarg);
+                break;
+            }
+            case 's': {
+                args.std = atof(optarg);
+                break;
+            }
+            case 'b': {
+                args.backend = find_backend(optarg);
+                if (!args.backend) {
+                    printf("Unknown backend: %s\n", optarg);
+                    args.flag = -1;
+                    return args;
+                }
+                break;
+            }
+            case 'n': {
+                args.batch_size = atoi(optarg);
+                break;
+            }
+            case 'c': {
+                args.coarse_factor = atoi(optarg);
+                break;
+            }
+            case 'R': {
+                args.regions = atoi(optarg);
+                break;
+            }
+            case 'L': {
+                args.lazy = true;
+                break;
+            }
+            case 'T': {
+                args.deadline_ms = atof(optarg);
+                break;
+            }
+            case 'P': {
+                args.prm_samples = atoi(optarg);
+                break;
+            }
+            case 'g': {
+                args.roadmap_file = optarg;
+                if (!args.prm_samples) args.prm_samples = RoadmapConfig().samples;
+                break;
+            }
+            case 'Q': {
+                args.lanes = atoi(optarg);
+                if (args.lanes != 8) {
+                    printf("Lockstep needs 8 lanes, got %s\n", optarg);
+                    args.flag = -1;
+                    return args;
+                }
+                break;
+            }
+            case 't': {
+                args.threads.num_threads = atoi(optarg);
+                break;
+            }
+            case 'a': {
+                if (!parse_affinity(optarg, args.threads)) {
+                    printf("Invalid affinity: %s\n", optarg);
+                    args.flag = -1;
+                    return args;
+                }
+                break;
+            }
+            case 'N': {
+                args.threads.numa = true;
+                break;
+            }
+            case 'o': {
+                args.export_prefix = optarg;
+                break;
+            }
+            case 'u': {
+                Rect rect;
+                if (sscanf(optarg, "%d,%d,%d,%d", &rect.x, &rect.y, &rect.width, &rect.height) !=
+                    4) {
+                    printf("Invalid update rectangle: %s\n", optarg);
+                    args.flag = -1;
+                    return args;
+                }
+                args.updates.push_back(rect);
+                break;
+            }
+            case 'D': {
+                args.diff_map = optarg;
+                break;
+            }
+            case 'k': {
+                args.counters = true;
+                if (optarg) args.counters_file = optarg;
+                break;
+            }
+            case 'x': {
+                args.trace_file = optarg;
+                break;
+            }
+            case 'p': {
+                args.plot = 1;
+                break;
+            }
+            case 'v': {
+                if (optarg) {
+                    args.verbose = atoi(optarg);
+                } else {
+                    args.verbose = 1;
+                }
+                break;
+            }
+            case 'h':
+            default:
+                usage(argv[0]);
+                args.flag = -1;
+                return args;
+        }
+    }
+    if (args.lanes && (args.prm_samples || !args.updates.empty() || !args.diff_map.empty())) {
+        printf("Lockstep queries cannot be combined with a roadmap or a replan\n");
+        args.flag = -1;
+        return args;
+    }
+    if (args.testruns > 1) {
+        args.verbose = 0;
+        args.plot = 0;
+    }
+    return args;
+}
+
+int main(int argc, char **argv) {
+    arguments args = process_opt(argc, argv);
+    if (args.flag) return 1;
+    if (args.verbose > 1) {
+        printf("startpos: [%.0f, %.0f], targetpos: [%.0f, %.0f]\n", args.startpos.x,
+               args.startpos.y, args.targetpos.x, args.targetpos.y);
+    }
+
+    configure_threads(args.threads);
+    // kernels are wrapped before the planner copies the backend pointer
+    if (args.counters) counters_start();
+    if (!args.trace_file.empty()) trace_start(args.trace_file);
+    if (!args.bench_file.empty()) phase_clock_start();
+    args.backend = counted_backend(args.backend);
+
+    /* read img as bool map; */
+    Mat img;
+    img = imread(args.map_name, IMREAD_GRAYSCALE);
+    vector<RunRecord> records;
+
+    PlannerConfig config;
+    config.step_size = args.step_size;
+    config.max_iter = args.max_iter;
+    config.max_node = args.max_node;
+    config.std = args.std;
+    config.radius = args.radius;
+    config.verbose = args.verbose;
+    config.batch_size = args.batch_size;
+    config.coarse_factor = args.coarse_factor;
+    config.regions = args.regions;
+    config.lazy = args.lazy;
+    config.deadline_ms = args.deadline_ms;
+    Planner planner(args.backend, config);
+
+    auto start = system_clock::now();
+    planner.set_map(img);
+    auto mid = system_clock::now();
+    const GridMap &map = planner.map();
+    if (args.verbose > 0) print_placement(stdout);
+    // the backends' worker pools exist once the map is inflated
+    counters_attach_threads();
+
+    if (args.plot) { // plot how the map is read (with obstacles inflated)
+        Mat temp_mat(img.rows, img.cols, CV_8U);
+        for (int i = 0; i < img.rows; ++i) {
+            for (int j = 0; j < img.cols; ++j) {
+                temp_mat.at<uint8_t>(i, j) = map[i][j] ? 255 : 0;
+            }
+        }
+        Point start_point = Point(args.startpos.x, args.startpos.y);
+        Point target_point = Point(args.targetpos.x, args.targetpos.y);
+        circle(temp_mat, start_point, 6, Scalar(0, 0, 0), 10, LINE_AA);
+        circle(temp_mat, target_point, 6, Scalar(0, 0, 0), 10, LINE_AA);
+        imwrite("res/read_map.png", temp_mat);
+    }
+
+    // decode the background once and leave rendering and file writes to another thread
+    unique_ptr<OutputWriter> writer;
+    if (args.plot || !args.export_prefix.empty()) {
+        Mat background = args.plot ? imread(args.map_name, IMREAD_COLOR_BGR) : Mat();
+        writer.reset(new OutputWriter(background,
+                                      args.plot ? string("result_") + args.backend->name : "",
+                                      args.export_prefix));
+    }
+
+    // roadmap mode: build (or load) the graph once, every run is then a graph query
+    unique_ptr<Roadmap> roadmap;
+    vector<Position> roadmap_path;
+    bool roadmap_found = false;
+    if (args.prm_samples > 0) {
+        RoadmapConfig roadmap_config;
+        roadmap_config.samples = args.prm_samples;
+        roadmap_config.max_edge = 4 * args.step_size;
+        roadmap_config.radius = args.radius;
+        roadmap.reset(new Roadmap(args.backend, roadmap_config));
+        auto build_start = system_clock::now();
+        bool loaded = !args.roadmap_file.empty() && roadmap->load(args.roadmap_file, map);
+        if (!loaded) {
+            roadmap->build(map);
+            if (!args.roadmap_file.empty()) roadmap->save(args.roadmap_file);
+        }
+        auto build_end = system_clock::now();
+        printf("Roadmap %s: %d nodes, %d edges in %.3fs\n", loaded ? "loaded" : "built",
+               roadmap->node_count(), roadmap->edge_count() / 2,
+               duration_cast<float_secs>(build_end - build_start).count());
+    }
+
+    // roadmap and lockstep runs grow no tree of their own, their exports hold only the path
+    const TreeStore no_tree;
+
+    // lockstep mode: every run is one lane of a batch, its query time runs from when a lane
+    // took it until it finished; the batch throughput is printed separately
+    vector<LockstepResult> lockstep_results;
+    if (args.lanes) {
+        auto solve = [&](int queries) {
+            vector<Position> starts(queries, args.startpos), goals(queries, args.targetpos);
+            LockstepPlanner<8>(map, config).solve(starts, goals, lockstep_results);
+        };
+        if (args.warmup) solve(args.warmup);
+        auto batch_start = system_clock::now();
+        solve(args.testruns);
+        float batch = duration_cast<float_secs>(system_clock::now() - batch_start).count();
+        int failed = 0;
+        for (const LockstepResult &result : lockstep_results) failed += !result.success;
+        printf("Lockstep: %d queries on %d lanes in %.3fs, %.1f queries/s, %d failed\n",
+               args.testruns, args.lanes, batch, args.testruns / batch, failed);
+        for (int runs = 0; runs < args.testruns; runs++) {
+            const LockstepResult &result = lockstep_results[runs];
+            RunRecord record;
+            record.success = result.success;
+            record.values[kMetricTime] = duration_cast<float_secs>(mid - start).count() + result.seconds;
+            record.values[kMetricQuery] = 1000 * result.seconds;
+            record.values[kMetricNodes] = result.nodes;
+            record.values[kMetricPathNodes] = result.path.size();
+            record.values[kMetricPathLength] = path_length(result.path);
+            records.push_back(record);
+            if (writer) {
+                writer->submit(no_tree, result.path, args.startpos, args.targetpos,
+                               result.success, runs);
+            }
+        }
+    }
+
+    auto query = [&]() {
+        if (roadmap) {
+            roadmap_found = roadmap->query(args.startpos, args.targetpos, roadmap_path);
+        } else {
+            planner.plan(args.startpos, args.targetpos);
+        }
+    };
+    // caches, page faults and worker pools settle before anything is recorded
+    for (int runs = 0; runs < (args.lanes ? 0 : args.warmup); runs++) query();
+    auto collision_ns = []() {
+        return phase_time_ns(kPhaseIntersection) + phase_time_ns(kPhaseCheckSegments);
+    };
+
+    for (int runs = 0; runs < (args.lanes ? 0 : args.testruns); runs++) {
+        uint64_t nearest_start = phase_time_ns(kPhaseNearest), collision_start = collision_ns();
+        auto plan_start = system_clock::now();
+        query();
+        auto plan_end = system_clock::now();
+        const vector<Position> &path = roadmap ? roadmap_path : planner.path();
+        float time = duration_cast<float_secs>(plan_end - plan_start).count();
+        // a roadmap query is timed alone, the map and the graph are shared by all of them
+        float total_time = roadmap ? time : duration_cast<float_secs>(mid - start).count() + time;
+        RunRecord record;
+        record.success = roadmap ? roadmap_found : planner.success();
+        record.timed_out = !roadmap && planner.timed_out();
+        record.values[kMetricTime] = total_time;
+        record.values[kMetricQuery] = 1000 * time;
+        record.values[kMetricPathNodes] = path.size();
+        record.values[kMetricPathLength] = path_length(path);
+        if (!roadmap) {
+            record.values[kMetricNodes] = planner.node_count();
+            record.values[kMetricPixels] = planner.pixels_tested();
+        }
+        if (phase_clock_enabled()) {
+            record.values[kMetricNearest] = (phase_time_ns(kPhaseNearest) - nearest_start) / 1e6;
+            record.values[kMetricCollision] = (collision_ns() - collision_start) / 1e6;
+        }
+        records.push_back(record);
+
+        if (roadmap && args.testruns == 1) {
+            printf("%s, query = %.3f ms\n", roadmap_found ? "Path found" : "Failed! No path",
+                   1000 * time);
+        } else if (args.testruns == 1) {
+            printf("Time = %.3fs\n", total_time);
+        }
+        if (args.verbose > 0 && !roadmap) printf("Pixels tested = %lld\n", planner.pixels_tested());
+        if (args.verbose > 1) {
+            printf("\nStart position\n");
+            for (size_t i = 0; i + 1 < path.size(); i++) {
+                printf("[%4.0f, %4.0f] -> ", path[i].x, path[i].y);
+                if (i % 4 == 0) cout << endl;
+            }
+            if (!path.empty()) {
+                if (path.size() % 4 != 2) cout << endl;
+                printf("[%4.0f, %4.0f]\nTarget position\n", path.back().x, path.back().y);
+            }
+        }
+        if (writer) {
+            writer->submit(roadmap ? no_tree : planner.tree(), path, args.startpos,
+                           args.targetpos, roadmap ? roadmap_found : planner.success(), runs);
+        }
+    }
+
+    // change the map under the last tree and repair it instead of planning from scratch
+    if (!args.updates.empty() || !args.diff_map.empty()) {
+        auto update_start = system_clock::now();
+        ReplanStats stats;
+        if (!args.diff_map.empty()) {
+            Mat edited = imread(args.diff_map, IMREAD_GRAYSCALE);
+            if (edited.rows != img.rows || edited.cols != img.cols) {
+                printf("Diff map %s does not match the map size\n", args.diff_map.c_str());
+                return 1;
+            }
+            stats = planner.apply_diff(edited);
+        }
+        if (!args.updates.empty()) {
+            stats += planner.apply_obstacles(args.updates);
+        }
+        auto replan_start = system_clock::now();
+        planner.replan();
+        auto replan_end = system_clock::now();
+        printf("Update = %.3fs, Replan = %.3fs\n",
+               duration_cast<float_secs>(replan_start - update_start).count(),
+               duration_cast<float_secs>(replan_end - replan_start).count());
+        printf("Cells changed = %d, edges checked = %d, invalid = %d, reattached = %d, "
+               "dropped = %d, tree = %d nodes\n",
+               stats.cells_changed, stats.edges_checked, stats.edges_invalid, stats.reattached,
+               stats.dropped, planner.tree().size());
+        if (writer) {
+            writer->submit(planner.tree(), planner.path(), args.startpos, args.targetpos,
+                           planner.success(), args.testruns);
+        }
+    }
+
+    print_counters(stdout);
+    if (!args.counters_file.empty()) write_counters(args.counters_file);
+
+    // Outliers are only flagged, every run goes into the statistics. The flag looks at the
+    // query time, which the one-off setup (inflation, roadmap build) does not blur.
+    vector<float> times = metric_values(records, kMetricTime);
+    vector<uint8_t> outlier = find_outliers(metric_values(records, kMetricQuery), 3.5);
+    if (args.testruns > 1) {
+        // roadmap queries take microseconds, they are shown in ms
+        const float scale = roadmap ? 1000 : 1;
+        int outliers = 0;
+        for (size_t i = 0; i < times.size(); i++) {
+            printf("Run%3zu = %.3f%s\n", i + 1, times[i] * scale, outlier[i] ? " (Outlier)" : "");
+            outliers += outlier[i];
+        }
+
+        for (float &time : times) time *= scale;
+        Summary summary = summarize(times);
+        printf("All Time in %s, Total test runs = %d, outliers = %d.\n",
+               roadmap ? "milliseconds" : "seconds", summary.n, outliers);
+        if (args.deadline_ms > 0) {
+            int timeouts = 0;
+            for (const RunRecord &record : records) timeouts += record.timed_out;
+            printf("Deadline of %.1f ms reached in %d of %d runs.\n", args.deadline_ms, timeouts,
+                   args.testruns);
+        }
+
+        printf("Avg. = %.3f, Std. = %.3f, P25 = %.3f, Median = %.3f, P75 = %.3f\n", summary.mean,
+               summary.std, summary.p25, summary.median, summary.p75);
+        printf("P90 = %.3f, P99 = %.3f, 95%% CI of Avg. = [%.3f, %.3f], of Median = [%.3f, %.3f]\n",
+               summary.p90, summary.p99, summary.mean_lo, summary.mean_hi, summary.median_lo,
+               summary.median_hi);
+        if (!args.bench_file.empty()) print_metric_table(stdout, records);
+    }
+    if (!args.bench_file.empty()) write_bench(args.bench_file, records, outlier);
+    return 0;
+}
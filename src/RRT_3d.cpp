@@ -0,0 +1,198 @@
+#include <getopt.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Maps.h"
+#include "NdRRT.h"
+
+using namespace std;
+using namespace chrono;
+using namespace rrt_nd;
+
+typedef duration<float> float_secs;
+
+struct arguments {
+        string volume;          // raw uint8 volume, 3D mode
+        int dims[3] = {0, 0, 0};
+        Vec<float, 3> startpos{};
+        Vec<float, 3> targetpos{};
+        int map = -1;           // >= 0: built-in 2D map, planned with the 2D instantiation
+        float radius = 15;
+        float step_size = 50;
+        float std = 1000;
+        int testruns = 1;
+        string path_file;
+        int verbose = 0;
+        int flag = 0;
+};
+
+void usage(const char *progname) {
+    printf("Usage: %s [options]\n", progname);
+    printf("Program Options:\n");
+    printf("  -V  --volume  <PATH>  Raw uint8 volume, voxels below 250 are obstacles\n");
+    printf("  -d  --dims    <X,Y,Z> Size of the volume\n");
+    printf("  -S  --start   <X,Y,Z> Start position\n");
+    printf("  -G  --goal    <X,Y,Z> Goal position\n");
+    printf("  -m  --map     <INT>   Run the 2D instantiation on a built-in map instead\n");
+    printf("  -r  --radius  <FLOAT> Voxels to inflate the obstacles by\n");
+    printf("  -l  --steplen <FLOAT> Step length for getting new nodes(>15)\n");
+    printf("  -s  --std     <FLOAT> Std for generate rand node\n");
+    printf("  -i  --iter    <INT>   Test iterations\n");
+    printf("  -o  --path    <PATH>  Write the path as one point per line\n");
+    printf("  -v  --verbose <INT>   Whether to print info\n");
+    printf("  -h  --help            This message\n");
+}
+
+bool parse_triple(const char *arg, float (&out)[3]) {
+    return sscanf(arg, "%f,%f,%f", &out[0], &out[1], &out[2]) == 3;
+}
+
+arguments process_opt(int argc, char *argv[]) {
+    const char *optstring = "V:d:S:G:m:r:l:s:i:o:v::h";
+    int opt;
+    static struct option long_options[] = {{"volume", 1, NULL, 'V'},  {"dims", 1, NULL, 'd'},
+                                           {"start", 1, NULL, 'S'},   {"goal", 1, NULL, 'G'},
+                                           {"map", 1, NULL, 'm'},     {"radius", 1, NULL, 'r'},
+                                           {"steplen", 1, NULL, 'l'}, {"std", 1, NULL, 's'},
+                                           {"iter", 1, NULL, 'i'},    {"path", 1, NULL, 'o'},
+                                           {"verbose", 2, NULL, 'v'}, {"help", 0, NULL, '?'}};
+    arguments args;
+    while ((opt = getopt_long(argc, argv, optstring, long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'V': {
+                args.volume = optarg;
+                break;
+            }
+            case 'd': {
+                if (sscanf(optarg, "%d,%d,%d", &args.dims[0], &args.dims[1], &args.dims[2]) != 3) {
+                    printf("Invalid volume size: %s\n", optarg);
+                    args.flag = -1;
+                    return args;
+                }
+                break;
+            }
+            case 'S':
+            case 'G': {
+                Vec<float, 3> &pos = opt == 'S' ? args.startpos : args.targetpos;
+                if (!parse_triple(optarg, pos.v)) {
+                    printf("Invalid position: %s\n", optarg);
+                    args.flag = -1;
+                    return args;
+                }
+                break;
+            }
+            case 'm': {
+                int i = atoi(optarg);
+                if (i >= 0 && i < _map_count) args.map = i;
+                break;
+            }
+            case 'r': {
+                args.radius = atof(optarg);
+                break;
+            }
+            case 'l': {
+                args.step_size = atof(optarg);
+                break;
+            }
+            case 's': {
+                args.std = atof(optarg);
+                break;
+            }
+            case 'i': {
+                args.testruns = max(1, atoi(optarg));
+                break;
+            }
+            case 'o': {
+                args.path_file = optarg;
+                break;
+            }
+            case 'v': {
+                if (optarg) {
+                    args.verbose = atoi(optarg);
+                } else {
+                    args.verbose = 1;
+                }
+                break;
+            }
+            case 'h':
+            default:
+                usage(argv[0]);
+                args.flag = -1;
+                return args;
+        }
+    }
+    if (args.map < 0 && (args.volume.empty() || args.dims[0] <= 0)) {
+        usage(argv[0]);
+        args.flag = -1;
+    }
+    return args;
+}
+
+// Inflate, then plan testruns times; prints the same Time line as RRT.
+template <int N>
+int run(const arguments &args, VoxelGrid<N> &grid, system_clock::time_point load_start,
+        const Vec<float, N> &start, const Vec<float, N> &goal) {
+    grid.inflate(static_cast<int>(ceil(args.radius)));
+    float setup = duration_cast<float_secs>(system_clock::now() - load_start).count();
+
+    typename NdPlanner<float, N>::Config config;
+    config.step_size = args.step_size;
+    config.std = args.std;
+    NdPlanner<float, N> planner(grid, config, random_device{}());
+    for (int runs = 0; runs < args.testruns; runs++) {
+        auto plan_start = system_clock::now();
+        bool found = planner.plan(start, goal);
+        float time = duration_cast<float_secs>(system_clock::now() - plan_start).count();
+        if (found) {
+            if (args.verbose > 0) {
+                printf("Finish RRT construction in with %zu nodes.\n", planner.tree().size());
+            }
+        } else {
+            printf("Failed! RRT construction terminated with %zu nodes.\n",
+                   planner.tree().size());
+        }
+        printf("Run%3d: Time = %.3fs (setup %.3fs), path of %zu nodes\n", runs + 1,
+               setup + time, setup, planner.path().size());
+    }
+
+    if (!args.path_file.empty()) {
+        FILE *out = fopen(args.path_file.c_str(), "w");
+        if (!out) {
+            fprintf(stderr, "cannot open %s for writing\n", args.path_file.c_str());
+            return 1;
+        }
+        for (const Vec<float, N> &pos : planner.path()) {
+            for (int i = 0; i < N; i++) fprintf(out, i ? " %.2f" : "%.2f", pos[i]);
+            fprintf(out, "\n");
+        }
+        fclose(out);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    arguments args = process_opt(argc, argv);
+    if (args.flag) return 1;
+
+    auto load_start = system_clock::now();
+    if (args.map >= 0) {
+        // same maps, same threshold as RRT, planned by the 2D specialization
+        Mat img = imread(_map_names[args.map], IMREAD_GRAYSCALE);
+        int dims[2] = {img.cols, img.rows};
+        VoxelGrid<2> grid(dims);
+        for (int y = 0; y < img.rows; y++) {
+            for (int x = 0; x < img.cols; x++) {
+                if (img.at<uint8_t>(y, x) < 250) grid.set(y * grid.stride(1) + x, false);
+            }
+        }
+        Vec<float, 2> start{{_startposs[args.map].x, _startposs[args.map].y}};
+        Vec<float, 2> goal{{_targetposs[args.map].x, _targetposs[args.map].y}};
+        return run<2>(args, grid, load_start, start, goal);
+    }
+
+    VoxelGrid<3> grid;
+    if (!VoxelGrid<3>::load_raw(args.volume, args.dims, 250, grid)) return 1;
+    return run<3>(args, grid, load_start, args.startpos, args.targetpos);
+}
@@ -0,0 +1,331 @@
+#include <getopt.h>
+#include <mpi.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "Affinity.h"
+#include "Maps.h"
+#include "Output.h"
+#include "Planner.h"
+
+using namespace std;
+using namespace rrt_utils;
+
+#ifndef RRT_DEFAULT_BACKEND
+#define RRT_DEFAULT_BACKEND "serial"
+#endif
+
+// Distributed RRT: every rank grows its own tree from the same start with its own seed.
+// Each round the ranks swap their newest nodes closest to the goal and a termination flag
+// with non-blocking collectives while they keep growing; received nodes are grafted onto
+// the local tree when a free edge reaches them. The first rank to connect the goal wins.
+
+// foreign nodes further than this many step lengths from the local tree are ignored
+const float kGraftReach = 4;
+
+struct arguments {
+        int max_node = 100000;
+        float std = 1000;
+        float radius = 15;
+        float step_size = 50;
+        string map_name = "res/map.png";
+        Position startpos = Position(1235, 330);
+        Position targetpos = Position(390, 665);
+        const Backend *backend = find_backend(RRT_DEFAULT_BACKEND);
+        ThreadConfig threads;
+        int interval = 64; // growth iterations between two exchanges
+        int frontier = 8;  // nodes each rank sends per exchange
+        string export_prefix;
+        int plot = 0;
+        int verbose = 0;
+        int flag = 0;
+};
+
+struct RankTimes {
+        double compute = 0; // map inflation, growth and grafting
+        double comm = 0;    // map broadcast, waiting on exchanges, path broadcast
+        double nodes = 0;
+        double grafted = 0;
+        double rounds = 0;
+};
+
+void usage(const char *progname) {
+    printf("Usage: mpirun -np <N> %s [options]\n", progname);
+    printf("Program Options:\n");
+    printf("  -m  --map      <INT>   Input map (0, 1, 2, 3, 4, 5)\n");
+    printf("  -r  --radius   <FLOAT> Radius to inflate the obstacles\n");
+    printf("  -l  --steplen  <FLOAT> Step length for getting new nodes(>15)\n");
+    printf("  -s  --std      <FLOAT> Std for generate rand node\n");
+    printf("  -b  --backend  <NAME>  Kernel backend inside each rank (serial, omp, pthread, ws)\n");
+    printf("  -t  --threads  <INT>   Worker threads per kernel inside each rank\n");
+    printf("  -a  --affinity <STR>   Pin threads: compact, scatter or a cpu list like 0,2,4-7\n");
+    printf("  -x  --exchange <INT>   Growth iterations between node exchanges\n");
+    printf("  -f  --frontier <INT>   Nodes each rank sends per exchange\n");
+    printf("  -p  --plot             Plot the winning tree and save\n");
+    printf("  -o  --export   <PATH>  Dump the winning tree and path to <PATH>_0.rrt\n");
+    printf("  -v  --verbose  <INT>   Whether to print info\n");
+    printf("  -h  --help             This message\n");
+}
+
+arguments process_opt(int argc, char *argv[], bool report) {
+    const char *optstring = "m:r:l:s:b:t:a:x:f:o:v::ph";
+    int opt;
+    static struct option long_options[] = {{"map", 1, NULL, 'm'},      {"radius", 1, NULL, 'r'},
+                                           {"steplen", 1, NULL, 'l'},  {"std", 1, NULL, 's'},
+                                           {"backend", 1, NULL, 'b'},  {"threads", 1, NULL, 't'},
+                                           {"affinity", 1, NULL, 'a'}, {"exchange", 1, NULL, 'x'},
+                                           {"frontier", 1, NULL, 'f'}, {"export", 1, NULL, 'o'},
+                                           {"plot", 0, NULL, 'p'},     {"verbose", 2, NULL, 'v'},
+                                           {"help", 0, NULL, '?'}};
+    arguments args;
+    while ((opt = getopt_long(argc, argv, optstring, long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'm': {
+                int i = atoi(optarg);
+                if (i >= 0 && i < _map_count) {
+                    args.map_name = _map_names[i];
+                    args.startpos = _startposs[i];
+                    args.targetpos = _targetposs[i];
+                }
+                break;
+            }
+            case 'r': {
+                args.radius = atof(optarg);
+                break;
+            }
+            case 'l': {
+                args.step_size = atof(optarg);
+                break;
+            }
+            case 's': {
+                args.std = atof(optarg);
+                break;
+            }
+            case 'b': {
+                args.backend = find_backend(optarg);
+                if (!args.backend) {
+                    if (report) printf("Unknown backend: %s\n", optarg);
+                    args.flag = -1;
+                    return args;
+                }
+                break;
+            }
+            case 't': {
+                args.threads.num_threads = atoi(optarg);
+                break;
+            }
+            case 'a': {
+                if (!parse_affinity(optarg, args.threads)) {
+                    if (report) printf("Invalid affinity: %s\n", optarg);
+                    args.flag = -1;
+                    return args;
+                }
+                break;
+            }
+            case 'x': {
+                args.interval = max(1, atoi(optarg));
+                break;
+            }
+            case 'f': {
+                args.frontier = max(1, atoi(optarg));
+                break;
+            }
+            case 'o': {
+                args.export_prefix = optarg;
+                break;
+            }
+            case 'p': {
+                args.plot = 1;
+                break;
+            }
+            case 'v': {
+                if (optarg) {
+                    args.verbose = atoi(optarg);
+                } else {
+                    args.verbose = 1;
+                }
+                break;
+            }
+            case 'h':
+            default:
+                if (report) usage(argv[0]);
+                args.flag = -1;
+                return args;
+        }
+    }
+    return args;
+}
+
+// Up to count nodes added since index first, closest to goal first; the rest of out is
+// padded with (-1, -1), which graft() skips.
+void pick_frontier(const TreeStore &tree, int first, Position goal, Position *out, int count) {
+    vector<float> best(count, 0);
+    int found = 0;
+    for (int idx = first; idx < tree.size(); idx++) {
+        float dist = distance(tree.pos[idx], goal);
+        if (found == count && dist >= best[found - 1]) continue;
+        int slot = found < count ? found++ : found - 1;
+        for (; slot > 0 && best[slot - 1] > dist; slot--) {
+            best[slot] = best[slot - 1];
+            out[slot] = out[slot - 1];
+        }
+        best[slot] = dist;
+        out[slot] = tree.pos[idx];
+    }
+    for (int i = found; i < count; i++) out[i] = Position(-1, -1);
+}
+
+int main(int argc, char **argv) {
+    int provided, rank, size;
+    // only the main thread of a rank calls MPI, kernel threads never do
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    arguments args = process_opt(argc, argv, rank == 0);
+    if (args.flag) {
+        MPI_Finalize();
+        return 1;
+    }
+    configure_threads(args.threads);
+    RankTimes times;
+    double wall_start = MPI_Wtime();
+
+    // rank 0 decodes the map, everyone else receives the raw pixels once
+    double t = MPI_Wtime();
+    Mat img;
+    int dims[2] = {0, 0};
+    if (rank == 0) {
+        img = imread(args.map_name, IMREAD_GRAYSCALE);
+        if (!img.empty()) {
+            dims[0] = img.rows;
+            dims[1] = img.cols;
+        }
+    }
+    MPI_Bcast(dims, 2, MPI_INT, 0, MPI_COMM_WORLD);
+    if (dims[0] == 0) {
+        if (rank == 0) printf("Cannot read %s\n", args.map_name.c_str());
+        MPI_Finalize();
+        return 1;
+    }
+    if (rank != 0) img = Mat(dims[0], dims[1], CV_8U);
+    MPI_Bcast(img.data, dims[0] * dims[1], MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+    times.comm += MPI_Wtime() - t;
+
+    t = MPI_Wtime();
+    PlannerConfig config;
+    config.step_size = args.step_size;
+    config.max_node = args.max_node;
+    config.std = args.std;
+    config.radius = args.radius;
+    config.verbose = args.verbose;
+    Planner planner(args.backend, config, random_device{}() + rank);
+    planner.set_map(img);
+    planner.begin(args.startpos, args.targetpos);
+    times.compute += MPI_Wtime() - t;
+
+    const int frontier = args.frontier;
+    vector<Position> send_nodes(frontier), recv_nodes((size_t)frontier * size);
+    // {rank if this rank reached the goal else size, 1 if it ran out of nodes}, min-reduced
+    int flags[2], result[2];
+    MPI_Request requests[2];
+    int exchanged = 1; // nodes from here on were not sent yet
+    int winner = size;
+    while (true) {
+        bool reached = planner.success();
+        bool exhausted = planner.node_count() >= args.max_node;
+        pick_frontier(planner.tree(), exchanged, args.targetpos, send_nodes.data(), frontier);
+        exchanged = planner.tree().size();
+        flags[0] = reached ? rank : size;
+        flags[1] = reached || exhausted;
+        t = MPI_Wtime();
+        MPI_Iallgather(send_nodes.data(), 2 * frontier, MPI_FLOAT, recv_nodes.data(),
+                       2 * frontier, MPI_FLOAT, MPI_COMM_WORLD, &requests[0]);
+        MPI_Iallreduce(flags, result, 2, MPI_INT, MPI_MIN, MPI_COMM_WORLD, &requests[1]);
+        times.comm += MPI_Wtime() - t;
+
+        // keep growing while the exchange is in flight, finish it after interval iterations
+        int complete = 0;
+        for (int iter = 0; iter < args.interval && !planner.success() &&
+                           planner.node_count() < args.max_node;
+             iter++) {
+            t = MPI_Wtime();
+            planner.step();
+            times.compute += MPI_Wtime() - t;
+            if (!complete) {
+                t = MPI_Wtime();
+                MPI_Testall(2, requests, &complete, MPI_STATUSES_IGNORE);
+                times.comm += MPI_Wtime() - t;
+            }
+        }
+        if (!complete) {
+            t = MPI_Wtime();
+            MPI_Waitall(2, requests, MPI_STATUSES_IGNORE);
+            times.comm += MPI_Wtime() - t;
+        }
+        times.rounds++;
+
+        if (result[0] < size) {
+            winner = result[0];
+            break;
+        }
+        if (result[1]) break; // every rank is out of nodes
+        if (!planner.success()) {
+            t = MPI_Wtime();
+            for (int r = 0; r < size; r++) {
+                if (r == rank) continue;
+                times.grafted += planner.graft(&recv_nodes[(size_t)r * frontier], frontier,
+                                               kGraftReach * args.step_size);
+            }
+            times.compute += MPI_Wtime() - t;
+        }
+    }
+
+    // the winner's path goes to every rank, rank 0 reports it
+    t = MPI_Wtime();
+    int root = winner < size ? winner : 0;
+    if (rank == root) planner.end();
+    vector<Position> path;
+    int path_len = rank == root ? planner.path().size() : 0;
+    MPI_Bcast(&path_len, 1, MPI_INT, root, MPI_COMM_WORLD);
+    path.resize(path_len);
+    if (rank == root) path = planner.path();
+    MPI_Bcast(path.data(), 2 * path_len, MPI_FLOAT, root, MPI_COMM_WORLD);
+    times.comm += MPI_Wtime() - t;
+    double wall = MPI_Wtime() - wall_start;
+
+    // the winning rank writes its own tree, no need to ship it around
+    if (rank == root && (args.plot || !args.export_prefix.empty())) {
+        Mat background = args.plot ? imread(args.map_name, IMREAD_COLOR_BGR) : Mat();
+        OutputWriter writer(background, args.plot ? "result_mpi" : "", args.export_prefix);
+        writer.submit(planner.tree(), path, args.startpos, args.targetpos, winner < size, 0);
+    }
+
+    times.nodes = planner.tree().size();
+    vector<RankTimes> all_times(size);
+    MPI_Gather(&times, sizeof(RankTimes) / sizeof(double), MPI_DOUBLE, all_times.data(),
+               sizeof(RankTimes) / sizeof(double), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("Time = %.3fs, ranks = %d, rounds = %.0f\n", wall, size, times.rounds);
+        if (winner < size) {
+            printf("Rank %d reached the goal, path of %d nodes\n", winner, path_len);
+        } else {
+            printf("Failed! No rank reached the goal.\n");
+        }
+        printf("Rank  Compute(s)  Comm(s)  Comm%%   Nodes  Grafted\n");
+        for (int r = 0; r < size; r++) {
+            const RankTimes &rt = all_times[r];
+            printf("%4d  %10.3f  %7.3f  %5.1f  %6.0f  %7.0f\n", r, rt.compute, rt.comm,
+                   100 * rt.comm / max(1e-9, rt.compute + rt.comm), rt.nodes, rt.grafted);
+        }
+        if (args.verbose > 1 && winner < size) {
+            printf("\nStart position\n");
+            for (const Position &pos : path) printf("[%4.0f, %4.0f]\n", pos.x, pos.y);
+            printf("Target position\n");
+        }
+    }
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,299 @@
+#include "Affinity.h"
+#include "Counters.h"
+#include "Planner.h"
+
+using namespace rrt_utils;
+
+// Incremental replanning when the occupancy map changes under an existing tree.
+
+namespace {
+    // side of a spatial-index bucket, in pixels; about one step length
+    const int kBucketSize = 32;
+    // nearest remaining nodes tried when reattaching an orphaned subtree
+    const int kReattachCandidates = 8;
+} // namespace
+
+ReplanStats Planner::apply_obstacles(const vector<Rect> &rects, uint8_t value) {
+    vector<Rect> clipped;
+    for (Rect rect : rects) {
+        int x0 = max(0, rect.x), y0 = max(0, rect.y);
+        int x1 = min(source.cols, rect.x + rect.width), y1 = min(source.rows, rect.y + rect.height);
+        if (x1 <= x0 || y1 <= y0) continue;
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) source.at<uint8_t>(y, x) = value;
+        }
+        clipped.push_back(Rect(x0, y0, x1 - x0, y1 - y0));
+    }
+    return update_regions(clipped);
+}
+
+ReplanStats Planner::apply_diff(const Mat &img) {
+    // compare tile by tile, every tile with a changed pixel becomes one region
+    const int tile = 64;
+    vector<Rect> dirty;
+    for (int ty = 0; ty < source.rows; ty += tile) {
+        for (int tx = 0; tx < source.cols; tx += tile) {
+            int x1 = min(source.cols, tx + tile), y1 = min(source.rows, ty + tile);
+            bool changed = false;
+            for (int y = ty; y < y1; y++) {
+                for (int x = tx; x < x1; x++) {
+                    if (source.at<uint8_t>(y, x) != img.at<uint8_t>(y, x)) {
+                        source.at<uint8_t>(y, x) = img.at<uint8_t>(y, x);
+                        changed = true;
+                    }
+                }
+            }
+            if (changed) dirty.push_back(Rect(tx, ty, x1 - tx, y1 - ty));
+        }
+    }
+    return update_regions(dirty);
+}
+
+// Bucket every edge (node -> parent) into the cells its bounding box touches.
+void Planner::build_edge_index() {
+    bucket_cols = (grid.width + kBucketSize - 1) / kBucketSize;
+    int bucket_rows = (grid.height + kBucketSize - 1) / kBucketSize;
+    edge_buckets.assign((size_t)bucket_cols * bucket_rows, vector<int>());
+    for (int idx = 0; idx < nodes.size(); idx++) {
+        int parent = nodes.parent[idx];
+        if (parent < 0) continue;
+        Position a = nodes.pos[idx], b = nodes.pos[parent];
+        int bx0 = (int)min(a.x, b.x) / kBucketSize, bx1 = (int)max(a.x, b.x) / kBucketSize;
+        int by0 = (int)min(a.y, b.y) / kBucketSize, by1 = (int)max(a.y, b.y) / kBucketSize;
+        for (int by = by0; by <= by1; by++) {
+            for (int bx = bx0; bx <= bx1; bx++) {
+                edge_buckets[(size_t)by * bucket_cols + bx].push_back(idx);
+            }
+        }
+    }
+    index_valid = true;
+}
+
+ReplanStats Planner::update_regions(const vector<Rect> &rects) {
+    ReplanStats stats;
+    if (!index_valid) build_edge_index();
+    int reach = (int)ceil(config_.radius);
+    vector<int> invalid;
+    vector<uint8_t> seen(nodes.size(), 0);
+
+    // Re-inflate every region first: an edge is only checked once, so it has to see all
+    // new obstacles, not just those of the rect whose buckets it was found in.
+    vector<Rect> blocked_regions;
+    for (const Rect &rect : rects) {
+        // an edited pixel changes the inflated map up to radius away
+        int x0 = max(0, rect.x - reach), y0 = max(0, rect.y - reach);
+        int x1 = min(grid.width, rect.x + rect.width + reach);
+        int y1 = min(grid.height, rect.y + rect.height + reach);
+        Rect region(x0, y0, x1 - x0, y1 - y0);
+        int blocked = 0;
+        int changed = reinflate_region(source, grid, config_.radius, region, blocked);
+        stats.cells_changed += changed;
+        if (!changed) continue;
+        update_replicas(grid, region.x, region.y, region.width, region.height);
+        if (config_.coarse_factor > 1) {
+            const int factor = config_.coarse_factor;
+            for (int cy = y0 / factor; cy <= (y1 - 1) / factor; cy++) {
+                for (int cx = x0 / factor; cx <= (x1 - 1) / factor; cx++) {
+                    uint8_t free_cell = 0;
+                    for (int y = cy * factor; y < min(grid.height, (cy + 1) * factor); y++) {
+                        for (int x = cx * factor; x < min(grid.width, (cx + 1) * factor); x++) {
+                            free_cell |= grid[y][x];
+                        }
+                    }
+                    coarse[cy][cx] = free_cell;
+                }
+            }
+        }
+        // freed cells cannot break an edge
+        if (blocked) blocked_regions.push_back(region);
+    }
+
+    // then every edge in the union of their buckets, once, against the final map
+    for (const Rect &region : blocked_regions) {
+        int x1 = region.x + region.width, y1 = region.y + region.height;
+        for (int by = region.y / kBucketSize; by <= (y1 - 1) / kBucketSize; by++) {
+            for (int bx = region.x / kBucketSize; bx <= (x1 - 1) / kBucketSize; bx++) {
+                for (int idx : edge_buckets[(size_t)by * bucket_cols + bx]) {
+                    if (seen[idx]) continue;
+                    seen[idx] = 1;
+                    stats.edges_checked++;
+                    if (backend->intersection(grid, nodes.pos[nodes.parent[idx]], nodes.pos[idx])) {
+                        invalid.push_back(idx);
+                    }
+                }
+            }
+        }
+    }
+    stats.edges_invalid = invalid.size();
+    if (!invalid.empty()) repair_tree(invalid, stats);
+    return stats;
+}
+
+// Children of every node in CSR form: child_list[child_start[i], child_start[i + 1]).
+void Planner::build_children() {
+    const int count = nodes.size();
+    child_start.assign(count + 1, 0);
+    child_list.resize(count);
+    for (int idx = 0; idx < count; idx++) {
+        if (nodes.parent[idx] >= 0) child_start[nodes.parent[idx] + 1]++;
+    }
+    for (int idx = 0; idx < count; idx++) child_start[idx + 1] += child_start[idx];
+    for (int idx = 0; idx < count; idx++) {
+        if (nodes.parent[idx] >= 0) child_list[child_start[nodes.parent[idx]]++] = idx;
+    }
+    // the fill advanced every start to the next node's start, shift them back
+    for (int idx = count; idx > 0; idx--) child_start[idx] = child_start[idx - 1];
+    child_start[0] = 0;
+}
+
+// Set node_state of root and everything below it; returns the number of nodes marked.
+int Planner::mark_subtree(int root, uint8_t value) {
+    int marked = 0;
+    subtree_stack.assign(1, root);
+    while (!subtree_stack.empty()) {
+        int idx = subtree_stack.back();
+        subtree_stack.pop_back();
+        node_state[idx] = value;
+        marked++;
+        for (int c = child_start[idx]; c < child_start[idx + 1]; c++) {
+            subtree_stack.push_back(child_list[c]);
+        }
+    }
+    return marked;
+}
+
+// Remove every node marked kDropped and renumber parents, goal_idx and edge_valid.
+void Planner::compact_tree() {
+    const int count = nodes.size();
+    const bool lazy = config_.lazy;
+    remap.assign(count, -1);
+    int kept = 0;
+    for (int idx = 0; idx < count; idx++) {
+        if (node_state[idx] == kDropped) continue;
+        remap[idx] = kept;
+        nodes.pos[kept] = nodes.pos[idx];
+        nodes.parent[kept] = nodes.parent[idx];
+        if (lazy) edge_valid[kept] = edge_valid[idx];
+        kept++;
+    }
+    nodes.pos.resize(kept);
+    nodes.parent.resize(kept);
+    if (lazy) edge_valid.resize(kept);
+    for (int idx = 0; idx < kept; idx++) {
+        if (nodes.parent[idx] >= 0) nodes.parent[idx] = remap[nodes.parent[idx]];
+    }
+    // a goal_idx left over from another tree would index past remap
+    goal_idx = goal_idx >= 0 && goal_idx < count ? remap[goal_idx] : -1;
+    index_valid = false;
+}
+
+// Renumber the tree breadth-first from the root, so every parent comes before its
+// children again, as Output.h and the exports expect. remap keeps old -> new; goal_idx
+// and edge_valid move with their nodes. Every node must hang off the root.
+void Planner::sort_parent_first() {
+    if (!nodes.size()) return;
+    build_children();
+    remap.assign(nodes.size(), -1);
+    subtree_stack.assign(1, 0); // old index of every sorted node, used as the queue
+    merged.reserve(nodes.pos.capacity()); // the two swap, keep them the same size
+    merged.clear();
+    remap[0] = merged.add(nodes.pos[0], -1);
+    for (int k = 0; k < merged.size(); k++) {
+        int old_idx = subtree_stack[k];
+        for (int c = child_start[old_idx]; c < child_start[old_idx + 1]; c++) {
+            int child = child_list[c];
+            remap[child] = merged.add(nodes.pos[child], k);
+            subtree_stack.push_back(child);
+        }
+    }
+    std::swap(nodes, merged);
+    if (config_.lazy) {
+        // node_state is free once a repair has compacted the tree
+        node_state.resize(nodes.size());
+        for (int k = 0; k < nodes.size(); k++) node_state[k] = edge_valid[subtree_stack[k]];
+        edge_valid.swap(node_state);
+    }
+    goal_idx = goal_idx >= 0 ? remap[goal_idx] : -1;
+    index_valid = false;
+}
+
+// Cut every invalid edge, then give each cut-off subtree a new parent among the nearest
+// nodes still connected to the root, or drop it. Finally compact the node arrays.
+void Planner::repair_tree(vector<int> &invalid, ReplanStats &stats) {
+    const int count = nodes.size();
+    int reattached = 0;
+    for (int idx : invalid) nodes.parent[idx] = -1;
+    build_children();
+    node_state.assign(count, kAttached);
+    for (int idx : invalid) mark_subtree(idx, kOrphaned);
+
+    vector<int> roots(invalid.begin(), invalid.end());
+    for (size_t r = 0; r < roots.size(); r++) {
+        int orphan = roots[r];
+        if (node_state[orphan] != kOrphaned) continue;
+        Position pos = nodes.pos[orphan];
+        if (!grid[(int)pos.y][(int)pos.x]) {
+            // the node itself is inside the new obstacle, its children start over
+            node_state[orphan] = kDropped;
+            stats.dropped++;
+            for (int c = child_start[orphan]; c < child_start[orphan + 1]; c++) {
+                nodes.parent[child_list[c]] = -1;
+                roots.push_back(child_list[c]);
+            }
+            continue;
+        }
+
+        // kReattachCandidates closest attached nodes, closest first
+        pair<double, int> best[kReattachCandidates];
+        int found_count = 0;
+        for (int idx = 0; idx < count; idx++) {
+            if (node_state[idx] != kAttached) continue;
+            double dist = distance(nodes.pos[idx], pos);
+            if (found_count == kReattachCandidates && dist >= best[found_count - 1].first) continue;
+            int slot = found_count < kReattachCandidates ? found_count++ : found_count - 1;
+            best[slot] = make_pair(dist, idx);
+            for (; slot > 0 && best[slot].first < best[slot - 1].first; slot--) {
+                swap(best[slot], best[slot - 1]);
+            }
+        }
+        int new_parent = -1;
+        for (int i = 0; i < found_count && new_parent < 0; i++) {
+            if (!backend->intersection(grid, nodes.pos[best[i].second], pos)) {
+                new_parent = best[i].second;
+            }
+        }
+        if (new_parent >= 0) {
+            nodes.parent[orphan] = new_parent;
+            mark_subtree(orphan, kAttached);
+            if (config_.lazy) edge_valid[orphan] = 1;
+            stats.reattached++;
+            reattached++;
+        } else {
+            stats.dropped += mark_subtree(orphan, kDropped);
+        }
+    }
+    compact_tree();
+    // a subtree can hang off a node with a higher index now
+    if (reattached) sort_parent_first();
+}
+
+bool Planner::replan() {
+    CounterScope scope(kPhaseReplan);
+    cancelled.store(false, std::memory_order_relaxed);
+    arm_deadline();
+    path_.clear();
+    n_count = 0;
+    // the tree still reaches the goal if the goal node survived the repair
+    pixels = 0;
+    found = goal_idx >= 0;
+    Position root = nodes.size() ? nodes.pos[0] : last_start;
+    if (!found && nodes.size() && grid[(int)root.y][(int)root.x]) {
+        found = grow(grid, last_start, last_goal, config_.step_size,
+                     max(15.0f, config_.step_size / 5), config_.std, config_.max_node, LLONG_MAX,
+                     true);
+        goal_idx = found ? nodes.size() - 1 : -1;
+        index_valid = false;
+    }
+    finish(last_goal);
+    return found;
+}
@@ -0,0 +1,329 @@
+#include "Roadmap.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Counters.h"
+#include "Scheduler.h"
+
+using namespace rrt_utils;
+
+namespace {
+    // nodes drawn from one RNG stream, so the roadmap does not depend on the thread count
+    const int kSampleChunk = 256;
+    const int kNearestGrain = 64;
+    const int32_t kFileVersion = 2;
+
+    // FNV-1a over the inflated cells: a roadmap only fits the map it was checked against
+    uint64_t map_hash(const GridMap &map) {
+        uint64_t hash = 14695981039346656037ull;
+        for (uint8_t cell : map.cells) {
+            hash ^= cell;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+} // namespace
+
+Roadmap::Roadmap(const Backend *_backend, RoadmapConfig _config)
+    : backend(_backend), config(_config) {
+    config.neighbours = min(64, max(1, config.neighbours));
+}
+
+void Roadmap::build(const GridMap &_map) {
+    CounterScope scope(kPhaseRoadmapBuild);
+    map = &_map;
+    TaskScheduler &scheduler = TaskScheduler::instance();
+
+    // sampling: every chunk rejects occupied cells with its own generator
+    const int chunks = (config.samples + kSampleChunk - 1) / kSampleChunk;
+    nodes.assign(config.samples, Position(-1, -1));
+    scheduler.parallel_for(0, chunks, 1, [&](int lo, int hi) {
+        for (int c = lo; c < hi; c++) {
+            mt19937 generator(config.seed + c);
+            uniform_real_distribution<float> along_x(0, map->width - 1);
+            uniform_real_distribution<float> along_y(0, map->height - 1);
+            int end = min(config.samples, (c + 1) * kSampleChunk);
+            // give up on maps that are (almost) fully blocked
+            for (int i = c * kSampleChunk, tries = 0; i < end && tries < 1000 * kSampleChunk;
+                 tries++) {
+                Position pos(along_x(generator), along_y(generator));
+                if ((*map)[(int)pos.y][(int)pos.x]) nodes[i++] = pos;
+            }
+        }
+    });
+    nodes.erase(remove_if(nodes.begin(), nodes.end(), [](const Position &p) { return p.x < 0; }),
+                nodes.end());
+    index_nodes();
+
+    // k-nearest neighbours of every node
+    const int n = nodes.size(), k = config.neighbours;
+    vector<int> knn((size_t)n * k), knn_count(n);
+    scheduler.parallel_for(0, n, kNearestGrain, [&](int lo, int hi) {
+        for (int i = lo; i < hi; i++) knn_count[i] = k_nearest(nodes[i], k, i, &knn[(size_t)i * k]);
+    });
+
+    // every neighbour pair once: i -> j is skipped only if j < i already listed i
+    vector<int> edge_from, edge_to;
+    edge_from.reserve((size_t)n * k);
+    edge_to.reserve((size_t)n * k);
+    for (int i = 0; i < n; i++) {
+        for (int a = 0; a < knn_count[i]; a++) {
+            int j = knn[(size_t)i * k + a];
+            const int *back = &knn[(size_t)j * k];
+            if (j < i && find(back, back + knn_count[j], i) != back + knn_count[j]) continue;
+            edge_from.push_back(i);
+            edge_to.push_back(j);
+        }
+    }
+
+    // collision checks with the backend's batch kernel
+    const int m = edge_from.size();
+    vector<Position> starts(m), ends(m);
+    vector<uint8_t> blocked(m);
+    for (int e = 0; e < m; e++) {
+        starts[e] = nodes[edge_from[e]];
+        ends[e] = nodes[edge_to[e]];
+    }
+    backend->check_segments(*map, starts.data(), ends.data(), m, blocked.data());
+
+    // both directions into CSR
+    offsets.assign(n + 1, 0);
+    for (int e = 0; e < m; e++) {
+        if (blocked[e]) continue;
+        offsets[edge_from[e] + 1]++;
+        offsets[edge_to[e] + 1]++;
+    }
+    for (int i = 0; i < n; i++) offsets[i + 1] += offsets[i];
+    targets.resize(offsets[n]);
+    lengths.resize(offsets[n]);
+    vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (int e = 0; e < m; e++) {
+        if (blocked[e]) continue;
+        float length = distance(starts[e], ends[e]);
+        targets[fill[edge_from[e]]] = edge_to[e];
+        lengths[fill[edge_from[e]]++] = length;
+        targets[fill[edge_to[e]]] = edge_from[e];
+        lengths[fill[edge_to[e]]++] = length;
+    }
+    open.reserve(targets.size() + config.neighbours + 1);
+}
+
+// Bucket the nodes into a uniform grid with about one node per cell.
+void Roadmap::index_nodes() {
+    const int n = nodes.size();
+    cell_size = max(1.0f, sqrt((float)map->width * map->height / max(1, n)));
+    grid_cols = (int)(map->width / cell_size) + 1;
+    grid_rows = (int)(map->height / cell_size) + 1;
+    cell_start.assign((size_t)grid_cols * grid_rows + 1, 0);
+    cell_nodes.resize(n);
+    auto cell_of = [&](const Position &p) {
+        return (int)(p.y / cell_size) * grid_cols + (int)(p.x / cell_size);
+    };
+    for (int i = 0; i < n; i++) cell_start[cell_of(nodes[i]) + 1]++;
+    for (size_t c = 0; c + 1 < cell_start.size(); c++) cell_start[c + 1] += cell_start[c];
+    vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+    for (int i = 0; i < n; i++) cell_nodes[fill[cell_of(nodes[i])]++] = i;
+
+    // query scratch, two slots past the roadmap for start and goal
+    cost.resize(n + 2);
+    came_from.resize(n + 2);
+    stamp.assign(n + 2, 0);
+    goal_edge.resize(n);
+    goal_stamp.assign(n, 0);
+    search_id = 0;
+    open.reserve(targets.size() + config.neighbours + 1);
+    start_links.reserve(config.neighbours);
+    start_lengths.reserve(config.neighbours);
+}
+
+// Search rings of cells around pos until the k-th best can no longer be beaten.
+int Roadmap::k_nearest(const Position &pos, int k, int skip, int *out) const {
+    float best[64];
+    int found = 0;
+    const int cx = (int)(pos.x / cell_size), cy = (int)(pos.y / cell_size);
+    const int max_ring = (int)(config.max_edge / cell_size) + 1;
+    for (int ring = 0; ring <= max_ring; ring++) {
+        for (int y = cy - ring; y <= cy + ring; y++) {
+            if (y < 0 || y >= grid_rows) continue;
+            // only the border of the ring, the inside was searched before
+            int step = (y == cy - ring || y == cy + ring) ? 1 : max(1, 2 * ring);
+            for (int x = cx - ring; x <= cx + ring; x += step) {
+                if (x < 0 || x >= grid_cols) continue;
+                int c = y * grid_cols + x;
+                for (int s = cell_start[c]; s < cell_start[c + 1]; s++) {
+                    int idx = cell_nodes[s];
+                    if (idx == skip) continue;
+                    float dist = distance(nodes[idx], pos);
+                    // the segment kernels need at least one pixel of length
+                    if (dist < 1 || dist > config.max_edge) continue;
+                    if (found == k && dist >= best[k - 1]) continue;
+                    int slot = found < k ? found++ : k - 1;
+                    for (; slot > 0 && best[slot - 1] > dist; slot--) {
+                        best[slot] = best[slot - 1];
+                        out[slot] = out[slot - 1];
+                    }
+                    best[slot] = dist;
+                    out[slot] = idx;
+                }
+            }
+        }
+        // every cell beyond this ring is at least ring * cell_size away
+        if (found == k && best[k - 1] <= ring * cell_size) break;
+    }
+    return found;
+}
+
+bool Roadmap::query(Position start, Position goal, vector<Position> &path) {
+    CounterScope scope(kPhaseRoadmapQuery);
+    path.clear();
+    if (!map || !map->inside(start.x, start.y) || !map->inside(goal.x, goal.y) ||
+        !(*map)[(int)start.y][(int)start.x] || !(*map)[(int)goal.y][(int)goal.x]) {
+        return false;
+    }
+    if (!backend->intersection(*map, start, goal)) {
+        path.push_back(start);
+        path.push_back(goal);
+        return true;
+    }
+    const int n = nodes.size(), source = n;
+    search_id++;
+    const unsigned open_mark = 2 * search_id, closed_mark = 2 * search_id + 1;
+
+    // hook start and goal onto the roadmap
+    int near[64];
+    int count = k_nearest(start, config.neighbours, -1, near);
+    start_links.clear();
+    start_lengths.clear();
+    for (int i = 0; i < count; i++) {
+        if (backend->intersection(*map, start, nodes[near[i]])) continue;
+        start_links.push_back(near[i]);
+        start_lengths.push_back(distance(start, nodes[near[i]]));
+    }
+    count = k_nearest(goal, config.neighbours, -1, near);
+    bool goal_linked = false;
+    for (int i = 0; i < count; i++) {
+        if (backend->intersection(*map, goal, nodes[near[i]])) continue;
+        goal_edge[near[i]] = distance(goal, nodes[near[i]]);
+        goal_stamp[near[i]] = search_id;
+        goal_linked = true;
+    }
+    if (start_links.empty() || !goal_linked) return false;
+
+    // A* with the straight-line distance to the goal as heuristic
+    auto relax = [&](int from, int to, float length) {
+        if (stamp[to] == closed_mark) return;
+        float g = cost[from] + length;
+        if (stamp[to] == open_mark && cost[to] <= g) return;
+        stamp[to] = open_mark;
+        cost[to] = g;
+        came_from[to] = from;
+        float f = to == n + 1 ? g : g + distance(nodes[to], goal);
+        open.push_back(make_pair(f, to));
+        push_heap(open.begin(), open.end(), greater<pair<float, int>>());
+    };
+    open.clear();
+    cost[source] = 0;
+    stamp[source] = closed_mark;
+    came_from[source] = -1;
+    for (size_t i = 0; i < start_links.size(); i++) relax(source, start_links[i], start_lengths[i]);
+    bool reached = false;
+    while (!open.empty()) {
+        pop_heap(open.begin(), open.end(), greater<pair<float, int>>());
+        int u = open.back().second;
+        open.pop_back();
+        if (stamp[u] == closed_mark) continue;
+        stamp[u] = closed_mark;
+        if (u == n + 1) {
+            reached = true;
+            break;
+        }
+        for (int e = offsets[u]; e < offsets[u + 1]; e++) relax(u, targets[e], lengths[e]);
+        if (goal_stamp[u] == search_id) relax(u, n + 1, goal_edge[u]);
+    }
+    if (!reached) return false;
+
+    path.push_back(goal);
+    for (int u = came_from[n + 1]; u != source; u = came_from[u]) path.push_back(nodes[u]);
+    path.push_back(start);
+    reverse(path.begin(), path.end());
+    return true;
+}
+
+bool Roadmap::save(const string &file_name) const {
+    FILE *out = fopen(file_name.c_str(), "wb");
+    if (!out) {
+        fprintf(stderr, "cannot open %s for writing\n", file_name.c_str());
+        return false;
+    }
+    int32_t header[6] = {0, kFileVersion, map ? map->width : 0, map ? map->height : 0,
+                         node_count(), edge_count()};
+    memcpy(&header[0], "RRPM", 4);
+    uint64_t hash = map ? map_hash(*map) : 0;
+    float params[2] = {config.radius, config.max_edge};
+    fwrite(header, sizeof(header), 1, out);
+    fwrite(&hash, sizeof(hash), 1, out);
+    fwrite(params, sizeof(params), 1, out);
+    fwrite(nodes.data(), sizeof(Position), nodes.size(), out);
+    fwrite(offsets.data(), sizeof(int32_t), offsets.size(), out);
+    for (int e = 0; e < edge_count(); e++) {
+        struct {
+                int32_t to;
+                float length;
+        } edge = {targets[e], lengths[e]};
+        fwrite(&edge, sizeof(edge), 1, out);
+    }
+    bool ok = !ferror(out);
+    fclose(out);
+    return ok;
+}
+
+bool Roadmap::load(const string &file_name, const GridMap &_map) {
+    FILE *in = fopen(file_name.c_str(), "rb");
+    if (!in) return false;
+    int32_t header[6];
+    uint64_t hash = 0;
+    float params[2];
+    // an older version, another map (even of the same size), another inflation radius
+    // or edge length means a rebuild
+    bool ok = fread(header, sizeof(header), 1, in) == 1 && memcmp(&header[0], "RRPM", 4) == 0 &&
+              header[1] == kFileVersion && header[2] == _map.width && header[3] == _map.height &&
+              header[4] >= 0 && header[5] >= 0 && fread(&hash, sizeof(hash), 1, in) == 1 &&
+              fread(params, sizeof(params), 1, in) == 1 && hash == map_hash(_map) &&
+              params[0] == config.radius && params[1] == config.max_edge;
+    if (ok) {
+        nodes.resize(header[4]);
+        offsets.resize(header[4] + 1);
+        targets.resize(header[5]);
+        lengths.resize(header[5]);
+        ok = fread(nodes.data(), sizeof(Position), nodes.size(), in) == nodes.size() &&
+             fread(offsets.data(), sizeof(int32_t), offsets.size(), in) == offsets.size();
+        for (int e = 0; ok && e < header[5]; e++) {
+            struct {
+                    int32_t to;
+                    float length;
+            } edge;
+            ok = fread(&edge, sizeof(edge), 1, in) == 1 && edge.to >= 0 && edge.to < header[4];
+            targets[e] = edge.to;
+            lengths[e] = edge.length;
+        }
+        ok = ok && offsets.front() == 0 && offsets.back() == header[5];
+        // every adjacency list has to lie inside targets, and nodes inside the map
+        for (int i = 0; ok && i < header[4]; i++) {
+            const Position &pos = nodes[i];
+            ok = offsets[i] <= offsets[i + 1] && pos.x >= 0 && pos.x < _map.width && pos.y >= 0 &&
+                 pos.y < _map.height;
+        }
+    }
+    fclose(in);
+    if (!ok) {
+        nodes.clear();
+        offsets.clear();
+        targets.clear();
+        lengths.clear();
+        return false;
+    }
+    map = &_map;
+    index_nodes();
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef __RRT_ROADMAP__
+#define __RRT_ROADMAP__
+
+#include "Util.h"
+
+struct RoadmapConfig {
+        int samples = 5000;   // free nodes in the roadmap
+        int neighbours = 10;  // k of the k-nearest connection
+        float max_edge = 200; // longer neighbour edges are not even checked
+        unsigned seed = 1;
+        float radius = 0;     // inflation of the map, only recorded in saved roadmaps
+};
+
+// Probabilistic roadmap over an inflated map, built once and shared by any number of
+// queries. Sampling, k-nearest search and edge checks run on the work-stealing
+// scheduler; a query only connects start and goal to the graph and runs A*.
+class Roadmap {
+    public:
+        Roadmap(const Backend *_backend, RoadmapConfig _config = RoadmapConfig());
+
+        void build(const GridMap &map);
+        // Binary, little-endian:
+        //   char[4] "RRPM", uint32 version (2), int32 width, height, node_count, edge_count
+        //   uint64 FNV-1a hash of the inflated map cells, float radius, float max_edge
+        //   node_count x {float x, float y}
+        //   (node_count + 1) x int32 offsets, then edge_count x {int32 to, float length}
+        // Every undirected edge is stored in both directions.
+        bool save(const string &file_name) const;
+        // false if the file is missing, malformed, or was built for another inflated map,
+        // radius or edge length
+        bool load(const string &file_name, const GridMap &map);
+
+        // path from start to goal through the roadmap, empty if there is none
+        bool query(Position start, Position goal, vector<Position> &path);
+
+        int node_count() const { return static_cast<int>(nodes.size()); }
+        int edge_count() const { return static_cast<int>(targets.size()); }
+
+    private:
+        void index_nodes();
+        // up to k nodes within config.max_edge of pos other than skip, closest first
+        int k_nearest(const Position &pos, int k, int skip, int *out) const;
+
+        const Backend *backend;
+        RoadmapConfig config;
+        const GridMap *map = nullptr;
+        vector<Position> nodes;
+        // adjacency in CSR form
+        vector<int> offsets;
+        vector<int> targets;
+        vector<float> lengths;
+        // uniform bucket grid over the nodes for the nearest searches
+        float cell_size = 1;
+        int grid_cols = 0, grid_rows = 0;
+        vector<int> cell_start;
+        vector<int> cell_nodes;
+        // A* scratch, sized with the roadmap; slot node_count() is the start. stamp is
+        // 2 * search_id while a node is open and 2 * search_id + 1 once it is settled,
+        // so nothing has to be cleared between queries.
+        vector<float> cost;
+        vector<int> came_from;
+        vector<unsigned> stamp;
+        unsigned search_id = 0;
+        vector<pair<float, int>> open;
+        // roadmap nodes visible from start / goal, and the goal edge of each node
+        vector<int> start_links;
+        vector<float> start_lengths;
+        vector<float> goal_edge;
+        vector<unsigned> goal_stamp; // == search_id when goal_edge is valid
+};
+#endif
@@ -0,0 +1,155 @@
+#include "Scheduler.h"
+
+#include <algorithm>
+
+#include "Affinity.h"
+#include "Trace.h"
+
+namespace {
+    // slot of the current thread in the scheduler, -1 outside of it
+    thread_local int tls_worker = -1;
+
+    struct SpinGuard {
+            std::atomic_flag &flag;
+            explicit SpinGuard(std::atomic_flag &_flag) : flag(_flag) {
+                while (flag.test_and_set(std::memory_order_acquire)) {
+                }
+            }
+            ~SpinGuard() { flag.clear(std::memory_order_release); }
+    };
+} // namespace
+
+bool TaskScheduler::Deque::push(const Task &task) {
+    SpinGuard guard(lock);
+    if (bottom - top >= kDequeCapacity) return false;
+    tasks[bottom % kDequeCapacity] = task;
+    bottom++;
+    return true;
+}
+
+bool TaskScheduler::Deque::pop(Task &task) {
+    SpinGuard guard(lock);
+    if (bottom == top) return false;
+    bottom--;
+    task = tasks[bottom % kDequeCapacity];
+    if (bottom == top) bottom = top = 0;
+    return true;
+}
+
+bool TaskScheduler::Deque::steal(Task &task) {
+    SpinGuard guard(lock);
+    if (bottom == top) return false;
+    task = tasks[top % kDequeCapacity];
+    top++;
+    return true;
+}
+
+TaskScheduler::TaskScheduler(int _num_threads)
+    : num_threads(std::max(1, _num_threads)), deques(num_threads) {
+    // slot 0 belongs to whichever thread calls parallel_for from outside
+    for (int t = 1; t < num_threads; t++) {
+        workers.emplace_back(&TaskScheduler::worker_loop, this, t);
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(park_mutex);
+        stop.store(true);
+    }
+    park_cv.notify_all();
+    for (std::thread &worker : workers) worker.join();
+}
+
+TaskScheduler &TaskScheduler::instance() {
+    static TaskScheduler scheduler(thread_count(std::thread::hardware_concurrency()));
+    return scheduler;
+}
+
+int TaskScheduler::grain_for(int n, int min_grain) const {
+    // about 8 pieces per worker is enough to even out irregular pieces
+    return std::max(min_grain, n / (num_threads * 8));
+}
+
+void TaskScheduler::execute(int self, Task task) {
+    Job *job = task.job;
+    while (task.hi - task.lo > job->grain) {
+        int mid = task.lo + (task.hi - task.lo) / 2;
+        if (!deques[self].push(Task{job, mid, task.hi})) break; // full, run the rest here
+        task.hi = mid;
+    }
+    {
+        TraceScope trace("task");
+        job->fn(job->ctx, task.lo, task.hi);
+    }
+    job->remaining.fetch_sub(task.hi - task.lo, std::memory_order_acq_rel);
+}
+
+bool TaskScheduler::run_one(int self) {
+    Task task;
+    if (deques[self].pop(task)) {
+        execute(self, task);
+        return true;
+    }
+    for (int i = 1; i < num_threads; i++) {
+        int victim = (self + i) % num_threads;
+        if (deques[victim].steal(task)) {
+            execute(self, task);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::worker_loop(int self) {
+    tls_worker = self;
+    pin_current_thread(self);
+    while (!stop.load(std::memory_order_relaxed)) {
+        if (run_one(self)) continue;
+        if (active.load(std::memory_order_acquire) > 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(park_mutex);
+        park_cv.wait(lock, [this] { return stop.load() || active.load() > 0; });
+    }
+}
+
+void TaskScheduler::parallel_for(int begin, int end, int grain, RangeFn fn, void *ctx) {
+    if (end <= begin) return;
+    grain = std::max(1, grain);
+    // too small to be worth sharing
+    if (end - begin <= grain || num_threads == 1) {
+        fn(ctx, begin, end);
+        return;
+    }
+
+    std::unique_lock<std::mutex> submit_lock(submit_mutex, std::defer_lock);
+    bool outer = tls_worker < 0;
+    if (outer) {
+        submit_lock.lock();
+        tls_worker = 0;
+    }
+    int self = tls_worker;
+
+    Job job;
+    job.fn = fn;
+    job.ctx = ctx;
+    job.grain = grain;
+    job.remaining.store(end - begin, std::memory_order_relaxed);
+    if (active.fetch_add(1, std::memory_order_acq_rel) == 0) {
+        { std::lock_guard<std::mutex> lock(park_mutex); }
+        park_cv.notify_all();
+    }
+
+    execute(self, Task{&job, begin, end});
+    {
+        TraceScope trace("join"); // helps with what others have not taken yet
+        while (job.remaining.load(std::memory_order_acquire) > 0) {
+            if (!run_one(self)) std::this_thread::yield();
+        }
+    }
+
+    active.fetch_sub(1, std::memory_order_acq_rel);
+    if (outer) tls_worker = -1;
+}
@@ -0,0 +1,80 @@
+#ifndef __RRT_SCHEDULER__
+#define __RRT_SCHEDULER__
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing scheduler behind the ws backend. Every worker owns a deque of index
+// ranges: it takes the newest range from the bottom, keeps halving it until it is no
+// larger than the grain and leaves the upper halves behind. Idle workers steal from the
+// top, where the oldest and therefore largest pieces sit.
+class TaskScheduler {
+    public:
+        typedef void (*RangeFn)(void *ctx, int lo, int hi);
+
+        // num_threads counts the calling thread, so num_threads - 1 workers are spawned
+        explicit TaskScheduler(int num_threads);
+        ~TaskScheduler();
+
+        // run fn over [begin, end) in pieces of at most grain items; returns when all are
+        // done. May be called from inside a task, the waiting thread keeps executing tasks.
+        void parallel_for(int begin, int end, int grain, RangeFn fn, void *ctx);
+        template <typename F>
+        void parallel_for(int begin, int end, int grain, const F &fn) {
+            parallel_for(
+                begin, end, grain,
+                [](void *ctx, int lo, int hi) { (*static_cast<const F *>(ctx))(lo, hi); },
+                const_cast<F *>(&fn));
+        }
+
+        // grain that leaves every worker a few pieces of n items, but at least min_grain
+        int grain_for(int n, int min_grain) const;
+        int size() const { return num_threads; }
+
+        static TaskScheduler &instance();
+
+    private:
+        static const int kDequeCapacity = 256;
+
+        struct Job {
+                RangeFn fn;
+                void *ctx;
+                int grain;
+                std::atomic<int> remaining;
+        };
+
+        struct Task {
+                Job *job;
+                int lo;
+                int hi;
+        };
+
+        // fixed-size deque guarded by a spinlock; owner and thieves rarely meet
+        struct alignas(64) Deque {
+                std::atomic_flag lock = ATOMIC_FLAG_INIT;
+                Task tasks[kDequeCapacity];
+                int top = 0;
+                int bottom = 0;
+
+                bool push(const Task &task);
+                bool pop(Task &task);
+                bool steal(Task &task);
+        };
+
+        bool run_one(int self);
+        void execute(int self, Task task);
+        void worker_loop(int self);
+
+        int num_threads;
+        std::vector<Deque> deques;
+        std::vector<std::thread> workers;
+        std::atomic<int> active{0};
+        std::atomic<bool> stop{false};
+        std::mutex submit_mutex;
+        std::mutex park_mutex;
+        std::condition_variable park_cv;
+};
+#endif
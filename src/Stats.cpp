@@ -0,0 +1,207 @@
+#include "Stats.h"
+
+#include "Scheduler.h"
+
+using namespace rrt_utils;
+
+namespace {
+    // resamples per task, each task seeds its own generator
+    const int kBootstrapChunk = 64;
+
+    const char *kMetricNames[kMetricCount] = {"time_s",      "query_ms",    "nodes",
+                                              "path_nodes",  "path_length", "pixels",
+                                              "nearest_ms",  "collision_ms"};
+
+    struct Statistic {
+            const char *name;
+            double Summary::*value;
+    };
+    const Statistic kStatistics[] = {
+        {"mean", &Summary::mean},           {"std", &Summary::std},
+        {"min", &Summary::min},             {"p25", &Summary::p25},
+        {"median", &Summary::median},       {"p75", &Summary::p75},
+        {"p90", &Summary::p90},             {"p99", &Summary::p99},
+        {"max", &Summary::max},             {"mean_ci_lo", &Summary::mean_lo},
+        {"mean_ci_hi", &Summary::mean_hi},  {"median_ci_lo", &Summary::median_lo},
+        {"median_ci_hi", &Summary::median_hi}};
+
+    // median of values, reordering them
+    double median_of(vector<float> &values) {
+        size_t mid = values.size() / 2;
+        nth_element(values.begin(), values.begin() + mid, values.end());
+        double upper = values[mid];
+        if (values.size() % 2) return upper;
+        return (*max_element(values.begin(), values.begin() + mid) + upper) / 2;
+    }
+} // namespace
+
+void RunningStats::add(double value) {
+    n++;
+    double delta = value - m;
+    m += delta / n;
+    m2 += delta * (value - m);
+    lo = n == 1 ? value : std::min(lo, value);
+    hi = n == 1 ? value : std::max(hi, value);
+}
+
+Summary summarize(const vector<float> &values, int resamples, unsigned seed) {
+    Summary summary;
+    RunningStats running;
+    vector<float> sorted;
+    sorted.reserve(values.size());
+    for (float value : values) {
+        if (isnan(value)) continue;
+        running.add(value);
+        sorted.push_back(value);
+    }
+    summary.n = running.count();
+    if (!summary.n) return summary;
+    summary.mean = running.mean();
+    summary.std = running.std();
+    summary.min = running.min();
+    summary.max = running.max();
+    sort(sorted.begin(), sorted.end());
+    summary.p25 = find_percentile(sorted, 25);
+    summary.median = find_percentile(sorted, 50);
+    summary.p75 = find_percentile(sorted, 75);
+    summary.p90 = find_percentile(sorted, 90);
+    summary.p99 = find_percentile(sorted, 99);
+    if (summary.n < 2 || resamples < 1) return summary;
+
+    const int n = summary.n;
+    vector<float> means(resamples), medians(resamples);
+    const int chunks = (resamples + kBootstrapChunk - 1) / kBootstrapChunk;
+    TaskScheduler::instance().parallel_for(0, chunks, 1, [&](int lo, int hi) {
+        vector<float> sample(n);
+        for (int c = lo; c < hi; c++) {
+            mt19937 generator(seed + c);
+            uniform_int_distribution<int> pick(0, n - 1);
+            int end = min(resamples, (c + 1) * kBootstrapChunk);
+            for (int b = c * kBootstrapChunk; b < end; b++) {
+                double sum = 0;
+                for (int i = 0; i < n; i++) {
+                    sample[i] = sorted[pick(generator)];
+                    sum += sample[i];
+                }
+                means[b] = sum / n;
+                medians[b] = median_of(sample);
+            }
+        }
+    });
+    sort(means.begin(), means.end());
+    sort(medians.begin(), medians.end());
+    summary.mean_lo = find_percentile(means, 2.5);
+    summary.mean_hi = find_percentile(means, 97.5);
+    summary.median_lo = find_percentile(medians, 2.5);
+    summary.median_hi = find_percentile(medians, 97.5);
+    return summary;
+}
+
+vector<uint8_t> find_outliers(const vector<float> &values, double threshold) {
+    vector<float> deviation;
+    deviation.reserve(values.size());
+    for (float value : values) {
+        if (!isnan(value)) deviation.push_back(value);
+    }
+    vector<uint8_t> outlier(values.size(), 0);
+    if (deviation.size() < 3) return outlier;
+    const double median = median_of(deviation);
+    for (float &value : deviation) value = fabs(value - median);
+    const double mad = median_of(deviation);
+    // with more than half the runs equal every other run would be an outlier
+    if (mad <= 0) return outlier;
+    for (size_t i = 0; i < values.size(); i++) {
+        // the modified z-score, 0.6745 * deviation / MAD, scales the MAD to a sigma
+        outlier[i] = !isnan(values[i]) && 0.6745 * fabs(values[i] - median) / mad > threshold;
+    }
+    return outlier;
+}
+
+const char *metric_name(RunMetric metric) { return kMetricNames[metric]; }
+
+vector<float> metric_values(const vector<RunRecord> &records, RunMetric metric) {
+    vector<float> values;
+    values.reserve(records.size());
+    for (const RunRecord &record : records) values.push_back(record.values[metric]);
+    return values;
+}
+
+void print_metric_table(FILE *out, const vector<RunRecord> &records) {
+    fprintf(out, "%-14s %6s %12s %12s %12s %12s %27s\n", "Metric", "n", "mean", "std", "median",
+            "p99", "mean 95% CI");
+    for (int m = 0; m < kMetricCount; m++) {
+        Summary summary = summarize(metric_values(records, RunMetric(m)));
+        if (!summary.n) continue;
+        fprintf(out, "%-14s %6d %12.4g %12.4g %12.4g %12.4g    [%10.4g, %10.4g]\n",
+                kMetricNames[m], summary.n, summary.mean, summary.std, summary.median,
+                summary.p99, summary.mean_lo, summary.mean_hi);
+    }
+}
+
+bool write_bench(const string &file_name, const vector<RunRecord> &records,
+                 const vector<uint8_t> &outlier) {
+    FILE *out = fopen(file_name.c_str(), "w");
+    if (!out) {
+        fprintf(stderr, "cannot open %s for writing\n", file_name.c_str());
+        return false;
+    }
+    const bool json = file_name.size() >= 5 && file_name.compare(file_name.size() - 5, 5, ".json") == 0;
+    // NaN is null in JSON and left out of the CSV
+    auto json_value = [&](const char *name, double value) {
+        if (isnan(value)) {
+            fprintf(out, ", \"%s\": null", name);
+        } else {
+            fprintf(out, ", \"%s\": %.9g", name, value);
+        }
+    };
+    auto csv_row = [&](const string &row, const char *metric, double value) {
+        if (!isnan(value)) fprintf(out, "%s,%s,%.9g\n", row.c_str(), metric, value);
+    };
+
+    if (json) {
+        fprintf(out, "{\n  \"runs\": [");
+    } else {
+        fprintf(out, "row,metric,value\n");
+    }
+    for (size_t i = 0; i < records.size(); i++) {
+        const RunRecord &record = records[i];
+        double flags[3] = {(double)record.success, (double)record.timed_out,
+                           (double)(i < outlier.size() && outlier[i])};
+        const char *flag_names[3] = {"success", "timed_out", "outlier"};
+        if (json) {
+            fprintf(out, "%s\n    {\"run\": %zu", i ? "," : "", i + 1);
+            for (int f = 0; f < 3; f++) json_value(flag_names[f], flags[f]);
+            for (int m = 0; m < kMetricCount; m++) json_value(kMetricNames[m], record.values[m]);
+            fprintf(out, "}");
+        } else {
+            for (int f = 0; f < 3; f++) csv_row(to_string(i + 1), flag_names[f], flags[f]);
+            for (int m = 0; m < kMetricCount; m++) {
+                csv_row(to_string(i + 1), kMetricNames[m], record.values[m]);
+            }
+        }
+    }
+    if (json) fprintf(out, "\n  ],\n  \"summary\": [");
+    bool first = true;
+    for (int m = 0; m < kMetricCount; m++) {
+        Summary summary = summarize(metric_values(records, RunMetric(m)));
+        if (!summary.n) continue;
+        if (json) {
+            fprintf(out, "%s\n    {\"metric\": \"%s\", \"n\": %d", first ? "" : ",",
+                    kMetricNames[m], summary.n);
+            for (const Statistic &statistic : kStatistics) {
+                json_value(statistic.name, summary.*statistic.value);
+            }
+            fprintf(out, "}");
+        } else {
+            csv_row("n", kMetricNames[m], summary.n);
+            for (const Statistic &statistic : kStatistics) {
+                csv_row(statistic.name, kMetricNames[m], summary.*statistic.value);
+            }
+        }
+        first = false;
+    }
+    if (json) fprintf(out, "\n  ]\n}\n");
+    bool ok = !ferror(out);
+    fclose(out);
+    return ok;
+}
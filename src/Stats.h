@@ -0,0 +1,74 @@
+#ifndef __RRT_STATS__
+#define __RRT_STATS__
+
+#include "Util.h"
+
+// What one -i run measured. NaN where the mode does not measure a metric (no node count
+// for roadmap queries, no kernel times without the phase clock).
+enum RunMetric {
+    kMetricTime,       // s, what "Run N =" prints
+    kMetricQuery,      // ms in plan() or query(), setup excluded
+    kMetricNodes,
+    kMetricPathNodes,
+    kMetricPathLength, // pixels
+    kMetricPixels,     // map cells read by collision checks
+    kMetricNearest,    // ms in the nearest kernel, summed over threads
+    kMetricCollision,  // ms in the intersection and check_segments kernels
+    kMetricCount
+};
+
+struct RunRecord {
+        bool success = false;
+        bool timed_out = false;
+        float values[kMetricCount];
+        RunRecord() {
+            for (float &value : values) value = NAN;
+        }
+};
+
+// Order statistics are exact. The 95% intervals come from a percentile bootstrap.
+struct Summary {
+        int n = 0;
+        double mean = NAN, std = NAN, min = NAN, max = NAN;
+        double p25 = NAN, median = NAN, p75 = NAN, p90 = NAN, p99 = NAN;
+        double mean_lo = NAN, mean_hi = NAN;
+        double median_lo = NAN, median_hi = NAN;
+};
+
+// Mean and variance in one pass (Welford), without keeping the values.
+class RunningStats {
+    public:
+        void add(double value);
+        int count() const { return n; }
+        double mean() const { return n ? m : NAN; }
+        double std() const { return n > 1 ? sqrt(m2 / (n - 1)) : 0; }
+        double min() const { return n ? lo : NAN; }
+        double max() const { return n ? hi : NAN; }
+
+    private:
+        int n = 0;
+        double m = 0, m2 = 0;
+        double lo = 0, hi = 0;
+};
+
+// NaN values are skipped. The resamples run in parallel on the task scheduler, each
+// with a generator seeded by its index, so the intervals do not depend on the thread
+// count.
+Summary summarize(const vector<float> &values, int resamples = 2000, unsigned seed = 1);
+
+// 1 for values whose modified z-score, 0.6745 * |value - median| / MAD, is above
+// threshold (3.5 is the usual choice). Median and MAD are not moved by the outliers
+// themselves, unlike mean and std. NaN values are never outliers.
+vector<uint8_t> find_outliers(const vector<float> &values, double threshold);
+
+const char *metric_name(RunMetric metric);
+// metric of every record, in run order
+vector<float> metric_values(const vector<RunRecord> &records, RunMetric metric);
+
+// one line per metric that was measured, over all runs
+void print_metric_table(FILE *out, const vector<RunRecord> &records);
+// Every run with its outlier flag, then the summary of all runs. .json, anything else is
+// written as CSV in long form: one "row,metric,value" line per run metric and per statistic.
+bool write_bench(const string &file_name, const vector<RunRecord> &records,
+                 const vector<uint8_t> &outlier);
+#endif
@@ -0,0 +1,139 @@
+#include "Trace.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+#include "Util.h"
+
+namespace {
+    struct TraceEvent {
+            const char *name;
+            uint64_t start; // ns since trace_start()
+            uint64_t duration;
+            pid_t tid;
+    };
+
+    // Single writer, the thread that holds the ring. head only grows; slot head % size
+    // is the next one to write.
+    struct TraceRing {
+            vector<TraceEvent> events;
+            std::atomic<uint64_t> head{0};
+            TraceRing() : events(kTraceEvents) {}
+    };
+
+    std::atomic<bool> active{false};
+    std::chrono::steady_clock::time_point epoch;
+    string trace_file;
+    // rings are only taken and handed back under the mutex, never while recording
+    std::mutex registry_mutex;
+    vector<unique_ptr<TraceRing>> registry;
+    vector<TraceRing *> free_rings;
+
+    uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - epoch)
+            .count();
+    }
+
+    // the ring of the calling thread, handed back for the next new thread on exit
+    struct ThreadRing {
+            TraceRing *ring = nullptr;
+            pid_t tid = 0;
+            ~ThreadRing() {
+                if (!ring) return;
+                std::lock_guard<std::mutex> lock(registry_mutex);
+                free_rings.push_back(ring);
+            }
+    };
+    thread_local ThreadRing tls_ring;
+
+    ThreadRing &this_thread() {
+        if (tls_ring.ring) return tls_ring;
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        if (free_rings.empty()) {
+            registry.emplace_back(new TraceRing());
+            tls_ring.ring = registry.back().get();
+        } else {
+            tls_ring.ring = free_rings.back();
+            free_rings.pop_back();
+        }
+        tls_ring.tid = static_cast<pid_t>(syscall(SYS_gettid));
+        return tls_ring;
+    }
+
+    void write_at_exit() { write_trace(trace_file); }
+} // namespace
+
+TraceScope::TraceScope(const char *_name) : name(_name) {
+    if (!active.load(std::memory_order_relaxed)) return;
+    on = true;
+    start = now_ns();
+}
+
+TraceScope::~TraceScope() {
+    if (!on) return;
+    uint64_t end = now_ns();
+    ThreadRing &self = this_thread();
+    TraceRing &ring = *self.ring;
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    ring.events[head % kTraceEvents] = TraceEvent{name, start, end - start, self.tid};
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+bool trace_start(const string &file_name) {
+    if (active.load()) return true;
+    FILE *probe = fopen(file_name.c_str(), "w");
+    if (!probe) {
+        fprintf(stderr, "cannot open %s for writing\n", file_name.c_str());
+        return false;
+    }
+    fclose(probe);
+    trace_file = file_name;
+    epoch = std::chrono::steady_clock::now();
+    atexit(write_at_exit);
+    active.store(true);
+    return true;
+}
+
+bool trace_enabled() { return active.load(std::memory_order_relaxed); }
+
+bool write_trace(const string &file_name) {
+    if (!trace_enabled()) return false;
+    FILE *out = fopen(file_name.c_str(), "w");
+    if (!out) {
+        fprintf(stderr, "cannot open %s for writing\n", file_name.c_str());
+        return false;
+    }
+    const pid_t pid = getpid();
+    // complete ("X") events, timestamps in microseconds
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    fprintf(out, "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                 "\"args\": {\"name\": \"RRT\"}}",
+            pid, pid);
+    uint64_t written = 0, overwritten = 0;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto &ring : registry) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > (uint64_t)kTraceEvents ? head - kTraceEvents : 0;
+        overwritten += first;
+        for (uint64_t i = first; i < head; i++) {
+            const TraceEvent &event = ring->events[i % kTraceEvents];
+            fprintf(out,
+                    ",\n  {\"name\": \"%s\", \"cat\": \"rrt\", \"ph\": \"X\", \"pid\": %d, "
+                    "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    event.name, pid, event.tid, event.start / 1e3, event.duration / 1e3);
+        }
+        written += head - first;
+    }
+    fprintf(out, "\n]}\n");
+    bool ok = !ferror(out);
+    fclose(out);
+    printf("Trace: %llu spans written to %s", (unsigned long long)written, file_name.c_str());
+    if (overwritten) printf(", %llu older ones overwritten", (unsigned long long)overwritten);
+    printf("\n");
+    return ok;
+}
@@ -0,0 +1,37 @@
+#ifndef __RRT_TRACE__
+#define __RRT_TRACE__
+
+#include <cstdint>
+#include <string>
+
+// Timeline of every thread in Chrome trace-event JSON, for chrome://tracing or
+// ui.perfetto.dev. Off until trace_start(); a disabled TraceScope costs one relaxed
+// atomic load.
+//
+// Every thread writes its spans to a ring buffer only it writes to. A full ring
+// overwrites its oldest spans, so a long run keeps its last kTraceEvents spans per
+// thread. A thread hands its ring on when it exits, which keeps the per-call workers
+// of the pthread backend from needing one ring each.
+
+const int kTraceEvents = 1 << 16; // spans per ring
+
+// One span on the calling thread, from construction to destruction. name must outlive
+// the trace (a string literal).
+class TraceScope {
+    public:
+        explicit TraceScope(const char *_name);
+        ~TraceScope();
+
+    private:
+        const char *name;
+        bool on = false; // tracing was enabled when the span began
+        uint64_t start = 0; // ns since trace_start()
+};
+
+// Enables every scope and writes the trace to file_name when the program exits.
+bool trace_start(const std::string &file_name);
+bool trace_enabled();
+// Writes what the rings hold now. Threads should be idle: a span being written while
+// its ring is read may come out torn.
+bool write_trace(const std::string &file_name);
+#endif
@@ -0,0 +1,158 @@
+#include "Util.h"
+
+namespace rrt_utils {
+
+    double distance(Position const& pos_1, Position const& pos_2) {
+        Position pos_diff = pos_1 - pos_2;
+
+        return sqrt(pow(pos_diff.x, 2) + pow(pos_diff.y, 2));
+    }
+
+    vector<float> get_bound(Position point, double radius) {
+        vector<float> bounds(4);
+        bounds[0] = point.x - radius;
+        bounds[1] = point.y - radius;
+        bounds[2] = point.x + radius;
+        bounds[3] = point.y + radius;
+        return bounds;
+    }
+
+    double find_percentile(const vector<float>& sorted, double ptile) {
+        if (sorted.empty()) return NAN;
+        // linear between the closest ranks, 0 is the smallest value and 100 the largest
+        double idx_ptile = min(max(ptile, 0.0), 100.0) / 100.0 * (sorted.size() - 1);
+        size_t low = floor(idx_ptile);
+        size_t high = min(low + 1, sorted.size() - 1);
+        return sorted[low] + (sorted[high] - sorted[low]) * (idx_ptile - low);
+    }
+
+    double mean(const vector<float>& vec) {
+        double sum = 0;
+        for (double val : vec) {
+            sum += val;
+        }
+        return sum / vec.size();
+    }
+
+    double std(const vector<float>& vec, double mean) {
+        if (vec.size() < 2) return 0;
+        double sum = 0.0;
+        double temp = 0.0;
+
+        for (double val : vec) {
+            temp = val - mean;
+            sum += temp * temp;
+        }
+
+        return sqrt(sum / (vec.size() - 1));
+    }
+} // namespace rrt_utils
+
+const Backend* find_backend(const string& name) {
+    const Backend* backends[] = {&serial_backend, &omp_backend, &pthread_backend,
+                                 &ws_backend};
+    for (const Backend* backend : backends) {
+        if (name == backend->name) return backend;
+    }
+    return nullptr;
+}
+
+int reinflate_region(const Mat& img, GridMap& out_map, double radius, Rect region,
+                     int& blocked) {
+    vector<uint8_t> before;
+    before.reserve((size_t)region.width * region.height);
+    for (int y = region.y; y < region.y + region.height; y++) {
+        uint8_t* row = out_map[y];
+        before.insert(before.end(), row + region.x, row + region.x + region.width);
+        fill(row + region.x, row + region.x + region.width, 1);
+    }
+
+    // every obstacle pixel whose square reaches into region
+    int reach = (int)ceil(radius);
+    int src_x0 = max(0, region.x - reach), src_x1 = min(img.cols, region.x + region.width + reach);
+    int src_y0 = max(0, region.y - reach), src_y1 = min(img.rows, region.y + region.height + reach);
+    for (int y = src_y0; y < src_y1; y++) {
+        for (int x = src_x0; x < src_x1; x++) {
+            if (img.at<uint8_t>(y, x) >= 250) continue;
+            int low_x = max(region.x, (int)ceil(x - radius));
+            int low_y = max(region.y, (int)ceil(y - radius));
+            int high_x = min(region.x + region.width - 1, (int)ceil(x + radius));
+            int high_y = min(region.y + region.height - 1, (int)ceil(y + radius));
+            for (int yy = low_y; yy <= high_y; ++yy) {
+                for (int xx = low_x; xx <= high_x; ++xx) {
+                    out_map[yy][xx] = 0;
+                }
+            }
+        }
+    }
+
+    int changed = 0;
+    blocked = 0;
+    size_t i = 0;
+    for (int y = region.y; y < region.y + region.height; y++) {
+        for (int x = region.x; x < region.x + region.width; x++, i++) {
+            if (before[i] == out_map[y][x]) continue;
+            changed++;
+            if (before[i]) blocked++;
+        }
+    }
+    return changed;
+}
+
+GridMap downsample_map(const GridMap& map, int factor) {
+    GridMap out((map.width + factor - 1) / factor, (map.height + factor - 1) / factor, 0);
+    for (int y = 0; y < map.height; y++) {
+        uint8_t* out_row = out[y / factor];
+        const uint8_t* row = map[y];
+        for (int x = 0; x < map.width; x++) {
+            out_row[x / factor] |= row[x];
+        }
+    }
+    return out;
+}
+
+Position random_position(Position const& target, float std, int width, int height,
+                         mt19937& generator) {
+    Position tmp_pos = {-1, -1};
+    while (tmp_pos.x >= width || tmp_pos.x < 0) {
+        tmp_pos.x = rrt_utils::normal(target.x, std, generator);
+    }
+    while (tmp_pos.y >= height || tmp_pos.y < 0) {
+        tmp_pos.y = rrt_utils::normal(target.y, std, generator);
+    }
+    return tmp_pos;
+}
+
+void plot(Mat temp_mat, const TreeStore& tree, const Position& startpos,
+          const Position& targetpos, const vector<Position>& path, string path_name) {
+    Point point_1, point_2;
+    Scalar red(0, 0, 255);
+    Scalar purple(173, 13, 106);
+    Scalar black(0, 0, 0);
+    int thickness = 2;
+
+    // nodes are stored parent-first, so insertion order is a valid drawing order
+    for (int i = 0; i < tree.size(); i++) {
+        if (tree.parent[i] < 0) continue;
+        Position p_1 = tree.pos[tree.parent[i]];
+        Position p_2 = tree.pos[i];
+        point_1 = Point(static_cast<int>(p_1.x), static_cast<int>(p_1.y));
+        point_2 = Point(static_cast<int>(p_2.x), static_cast<int>(p_2.y));
+        drawMarker(temp_mat, point_2, purple, MARKER_DIAMOND, 4, thickness, LINE_8);
+        line(temp_mat, point_1, point_2, black, 1, LINE_8);
+    }
+
+    point_1 = Point(startpos.x, startpos.y);
+    circle(temp_mat, point_1, 6, Scalar(255, 0, 0), 10, LINE_AA);
+
+    for (size_t i = 0; i + 1 < path.size(); i++) {
+        point_1 = Point(static_cast<int>(path[i].x), static_cast<int>(path[i].y));
+        point_2 = Point(static_cast<int>(path[i + 1].x), static_cast<int>(path[i + 1].y));
+        drawMarker(temp_mat, point_2, purple, MARKER_DIAMOND, 6, 3, LINE_8);
+        line(temp_mat, point_1, point_2, red, thickness, LINE_8);
+    }
+
+    point_2 = Point(targetpos.x, targetpos.y);
+    circle(temp_mat, point_2, 6, Scalar(0, 255, 0), 10, LINE_AA);
+    imwrite("res/" + path_name + ".png", temp_mat);
+}
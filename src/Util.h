@@ -1,3 +1,6 @@
+#ifndef __RRT_UTIL__
+#define __RRT_UTIL__
+
 #include <getopt.h>
 #include <omp.h>
 
@@ -11,6 +14,7 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <queue>
 #include <random>
+#include <string>
 #include <vector>
 #include <atomic>
 #include <algorithm>
@@ -18,13 +22,11 @@
 using namespace std;
 using namespace cv;
 
-
-// #ifndef __RRT_UTIL__
-// #define __RRT_UTIL__
 struct Position {
         float x;
         float y;
 
+        Position() : x(0), y(0) {}
         Position(float _x, float _y) : x(_x), y(_y) {}
         Position operator+(const Position &other) const {
             return Position(x + other.x, y + other.y);
@@ -53,77 +55,111 @@ namespace rrt_utils {
 
     vector<float> get_bound(Position point, double radius);
 
-    double find_percentile(vector<float> vec, int ptile);
-    double mean(vector<float> vec);
-    double std(vector<float> vec, double mean);
+    // ptile in [0, 100] of an ascending vector, NaN when it is empty
+    double find_percentile(const vector<float> &sorted, double ptile);
+    double mean(const vector<float> &vec);
+    double std(const vector<float> &vec, double mean);
 } // namespace rrt_utils
 
-struct TreeNode {
-        Position pos;
-        std::vector<TreeNode *> child;
-        TreeNode *parent = nullptr;
-
-        TreeNode(Position _pos) : pos(_pos) {}
-        TreeNode(Position _pos, TreeNode *_parent) : pos(_pos), parent(_parent) {}
+// Inflated occupancy grid, row-major in a single buffer (1 = free, 0 = obstacle).
+// map[y][x] indexes it the same way the old vector<vector<uint8_t>> did.
+struct GridMap {
+        int width = 0;
+        int height = 0;
+        vector<uint8_t> cells;
+
+        GridMap() {}
+        GridMap(int _width, int _height, uint8_t fill = 1)
+            : width(_width), height(_height), cells((size_t)_width * _height, fill) {}
+        uint8_t *operator[](int y) { return &cells[(size_t)y * width]; }
+        const uint8_t *operator[](int y) const { return &cells[(size_t)y * width]; }
+        bool inside(int x, int y) const { return x >= 0 && y >= 0 && x < width && y < height; }
 };
 
-class Tree {
-    public:
-        Tree(TreeNode *_root) : root(_root) {}
-        Tree(TreeNode *_root, TreeNode *_end) : root(_root), end(_end) {}
-        ~Tree();
-        TreeNode *root;
-        TreeNode *end;
-        bool success = false;
-};
+// Flat tree storage: node i is at pos[i] and hangs off parent[i] (-1 for the root).
+// Capacity is kept across queries, so a warmed-up tree never reallocates.
+struct TreeStore {
+        vector<Position> pos;
+        vector<int> parent;
 
-struct result {
-        Tree *tree;
-        vector<Position> path;
-        float time;
+        void reserve(size_t n) {
+            pos.reserve(n);
+            parent.reserve(n);
+        }
+        void clear() {
+            pos.clear();
+            parent.clear();
+        }
+        int add(Position p, int parent_idx) {
+            pos.push_back(p);
+            parent.push_back(parent_idx);
+            return static_cast<int>(pos.size()) - 1;
+        }
+        int size() const { return static_cast<int>(pos.size()); }
 };
 
 struct CheckSegArgs {
-    const vector<vector<uint8_t>>* map;
+    const GridMap* map;
     const Position* start;
     const Position* end;
     int start_idx;
     int end_idx;
-    int x_bound;
-    int y_bound;
+    int num_points;
     std::atomic<bool>* flag;
 };
 
 struct NearestArgs {
-    const vector<TreeNode*>* vec;
-    const TreeNode* target;
-    size_t start_idx;
-    size_t end_idx;
+    const Position* nodes;
+    Position target;
+    int start_idx;
+    int end_idx;
     double local_min_dist;
     int local_min_node;
 };
 
 struct InflateArgs {
     const Mat* img;
-    vector<vector<uint8_t>>* out_map;
+    GridMap* out_map;
     double radius;
     int start_idx;
     int end_idx;
 };
 
-TreeNode *get_new_node(const vector<vector<uint8_t>> &map, TreeNode *start, TreeNode *target,
-                       double step_size);
+// Parallel kernels of one backend. Every Util_<backend>.cpp fills one of these,
+// so all backends can be linked together and picked at runtime.
+struct Backend {
+        const char *name;
+        // check interseced with obstacles
+        bool (*intersection)(const GridMap &map, const Position &start, const Position &end);
+        // index of the node nearest to target among nodes[0, count)
+        int (*nearest)(const Position *nodes, int count, const Position &target);
+        void (*inflate_map)(const Mat &img, GridMap &out_map, double radius);
+        // batched intersection(): blocked[i] for the edge starts[i] -> ends[i]
+        void (*check_segments)(const GridMap &map, const Position *starts, const Position *ends,
+                               int count, uint8_t *blocked);
+};
+
+extern const Backend serial_backend;
+extern const Backend omp_backend;
+extern const Backend pthread_backend;
+extern const Backend ws_backend;
 
-TreeNode *random_position(Position const &target, float std, std::mt19937 &generator);
+// nullptr if no backend has that name
+const Backend *find_backend(const string &name);
 
-// check interseced with obstacles
-bool intersection(const vector<vector<uint8_t>> &map, const Position &start, const Position &end);
+// Redo the inflation inside region (already grown by the radius around an edit of img).
+// Returns the number of cells that changed, blocked counts those that became obstacles.
+int reinflate_region(const Mat &img, GridMap &out_map, double radius, Rect region,
+                     int &blocked);
 
-// find nearest tree node
-TreeNode *nearest(vector<TreeNode*> &vec, const TreeNode *target);
+// factor x factor blocks of map; a block is free if any cell in it is, so two free cells
+// connected in map stay connected. Walls thinner than a block can leak, which is only
+// a hint for the coarse search: its path is re-planned at full resolution.
+GridMap downsample_map(const GridMap &map, int factor);
 
-void inflate_map(Mat img, vector<vector<uint8_t>> &out_map, double radius);
+Position random_position(Position const &target, float std, int width, int height,
+                         std::mt19937 &generator);
 
-void plot(Mat map, Tree *tree, const Position &startpos, const Position &endpos,
-          vector<Position> path, string path_name = "");
-// #endif
\ No newline at end of file
+void plot(Mat map, const TreeStore &tree, const Position &startpos, const Position &endpos,
+          const vector<Position> &path, string path_name = "");
+#endif
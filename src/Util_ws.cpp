@@ -0,0 +1,107 @@
+#include <cstring>
+#include <mutex>
+
+#include "Affinity.h"
+#include "Scheduler.h"
+#include "Util.h"
+
+namespace rrt_ws {
+
+    // Smallest pieces worth handing to another worker. Anything below runs inline on the
+    // calling thread, which keeps the short edges of a normal extension dispatch-free.
+    const int kNearestGrain = 512;
+    const int kSegmentGrain = 256;
+    const int kTileSize = 64;
+
+    bool intersection(const GridMap& map, const Position& start, const Position& end) {
+        int num_points = static_cast<int>(rrt_utils::distance(start, end));
+        std::atomic<bool> blocked(false);
+        TaskScheduler& scheduler = TaskScheduler::instance();
+
+        scheduler.parallel_for(
+            0, num_points + 1, scheduler.grain_for(num_points + 1, kSegmentGrain),
+            [&](int lo, int hi) {
+                if (blocked.load(std::memory_order_relaxed)) return;
+                const GridMap& local = local_map(map);
+                for (int i = lo; i < hi; ++i) {
+                    int x = start.x + static_cast<int>((end.x - start.x) * i / num_points);
+                    int y = start.y + static_cast<int>((end.y - start.y) * i / num_points);
+                    if (!local[y][x]) {
+                        blocked.store(true, std::memory_order_relaxed);
+                        return;
+                    }
+                }
+            });
+        return blocked.load(std::memory_order_relaxed);
+    }
+
+    int nearest(const Position* nodes, int count, const Position& target) {
+        // chunks combine at full precision, ties going to the lower index like the serial
+        // scan; one lock per chunk, not per node
+        std::mutex best_mutex;
+        double min_dist = std::numeric_limits<double>::max();
+        int min_node = 0;
+        TaskScheduler& scheduler = TaskScheduler::instance();
+
+        scheduler.parallel_for(0, count, scheduler.grain_for(count, kNearestGrain),
+                               [&](int lo, int hi) {
+                                   double local_min_dist = std::numeric_limits<double>::max();
+                                   int local_min_node = lo;
+                                   for (int i = lo; i < hi; i++) {
+                                       double dist = rrt_utils::distance(nodes[i], target);
+                                       if (dist < local_min_dist) {
+                                           local_min_dist = dist;
+                                           local_min_node = i;
+                                       }
+                                   }
+                                   std::lock_guard<std::mutex> lock(best_mutex);
+                                   if (local_min_dist < min_dist ||
+                                       (local_min_dist == min_dist && local_min_node < min_node)) {
+                                       min_dist = local_min_dist;
+                                       min_node = local_min_node;
+                                   }
+                               });
+        return min_node;
+    }
+
+    void inflate_map(const Mat& img, GridMap& out_map, double radius) {
+        int tiles_x = (img.cols + kTileSize - 1) / kTileSize;
+        int tiles_y = (img.rows + kTileSize - 1) / kTileSize;
+        TaskScheduler& scheduler = TaskScheduler::instance();
+
+        // obstacle density varies a lot between tiles, hence single-tile grains
+        scheduler.parallel_for(0, tiles_x * tiles_y, 1, [&](int lo, int hi) {
+            for (int tile = lo; tile < hi; tile++) {
+                int tile_x0 = (tile % tiles_x) * kTileSize;
+                int tile_y0 = (tile / tiles_x) * kTileSize;
+                int tile_x1 = min(img.cols, tile_x0 + kTileSize);
+                int tile_y1 = min(img.rows, tile_y0 + kTileSize);
+                for (int y = tile_y0; y < tile_y1; y++) {
+                    for (int x = tile_x0; x < tile_x1; x++) {
+                        if (img.at<uint8_t>(y, x) >= 250) continue;
+                        int low_x = max(0, (int)ceil(x - radius));
+                        int low_y = max(0, (int)ceil(y - radius));
+                        int high_x = min(img.cols - 1, (int)ceil(x + radius));
+                        int high_y = min(img.rows - 1, (int)ceil(y + radius));
+                        for (int yy = low_y; yy <= high_y; ++yy) {
+                            memset(&out_map[yy][low_x], 0, high_x - low_x + 1);
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    void check_segments(const GridMap& map, const Position* starts, const Position* ends,
+                         int count, uint8_t* blocked) {
+        // one task per candidate edge; long edges split again inside intersection()
+        TaskScheduler::instance().parallel_for(0, count, 1, [&](int lo, int hi) {
+            for (int i = lo; i < hi; i++) {
+                blocked[i] = intersection(map, starts[i], ends[i]);
+            }
+        });
+    }
+} // namespace rrt_ws
+
+extern const Backend ws_backend = {"ws", rrt_ws::intersection, rrt_ws::nearest,
+                                   rrt_ws::inflate_map, rrt_ws::check_segments};